@@ -15,7 +15,10 @@
 //     https://github.com/yongchaofan/tinyTerm2/issues/new
 //
 #include <thread>
+#include <chrono>
+#include <regex>
 #include "Fl_Term.h"
+#include "script.h"
 #include <FL/fl_ask.H>
 #include <FL/filename.H>
 
@@ -33,6 +36,11 @@ HOST *host_new(const char *hostname);
 #define FL_CMD FL_ALT
 #endif
 
+static double clock_secs()	//monotonic time in seconds, for recording
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
 void host_cb(void *data, const char *buf, int len)
 {
 	Fl_Term *term = (Fl_Term *)data;
@@ -43,7 +51,12 @@ char *host_cb1(void *data, const char *prompt, bool echo)
 	Fl_Term *term = (Fl_Term *)data;
 	return term->gets(prompt, echo);
 }
-int Fl_Term::connect(HOST *newhost, const char **preply )
+void host_cb2(void *data, const char *prompt, bool echo)
+{
+	Fl_Term *term = (Fl_Term *)data;
+	term->ask(prompt, echo);
+}
+int Fl_Term::connect(HOST *newhost, REPLY *reply )
 {
 	int rc = 0;
 	if ( host->live() ) return rc;
@@ -53,15 +66,13 @@ int Fl_Term::connect(HOST *newhost, const char **preply )
 	strncpy(sTitle, host->name(), 40);
 	sTitle[40]=0;
 	copy_label(sTitle);
-	host->callback(host_cb, host_cb1, this);
+	host->callback(host_cb, host_cb1, host_cb2, this);
 
-	bGets = false;
+	bGets = bAsk = bMarks = false;
 	mark_prompt();
 	host->connect();
-	if ( preply!=NULL ) {	//waitfor prompt if called from script
-		*preply = buff+recv0;	//no wait if called from edit line
-		rc = waitfor_prompt();
-	}
+	if ( reply!=NULL )		//waitfor prompt if called from script
+		rc = waitfor_prompt(reply);	//no wait if called from edit line
 	return rc;
 }
 void Fl_Term::puts( const char *buf, int len )	//parse text received from host
@@ -72,10 +83,24 @@ void Fl_Term::puts( const char *buf, int len )	//parse text received from host
 	}
 	else
 		if ( len>0 ) {//data from host, display
+			if ( fpRecord!=NULL ) {
+				append_mtx.lock();
+				if ( fpRecord!=NULL ) {
+					fprintf(fpRecord, "%.6f %d\n", clock_secs()-record_start, len);
+					fwrite(buf, 1, len, fpRecord);
+					fputc('\n', fpRecord);
+				}
+				append_mtx.unlock();
+			}
+			if ( tap_cb!=NULL ) tap_cb(tap_data, buf, len);
+			double t0 = clock_secs();
 			if ( host->type()==HOST_CONF )
 				put_xml(buf, len);
 			else
 				append(buf, len);
+			metric_add(stats.bytes_in, len);
+			metric_add(stats.parse_ns,
+						(unsigned long long)((clock_secs()-t0)*1e9));
 		}
 		else {//len<0 Disconnected, or failure
 			if ( *buf ) {
@@ -94,6 +119,7 @@ void Fl_Term::write(const char *buf, int len) //send text to host
 		if ( !bGets ) {
 			if ( bEcho ) append(buf, len);
 			host->write(buf, len);
+			metric_add(stats.bytes_out, len);
 			return;
 		}
 		for ( int i=0; i<len&&bGets; i++ ) {
@@ -108,7 +134,15 @@ void Fl_Term::write(const char *buf, int len) //send text to host
 				case '\r': 
 					keys[cursor++]=0;
 					append("\r\n", 2);
-					bReturn=true;
+					if ( bAsk ) {
+						bAsk = bGets = false;
+						host->answer(keys);
+					}
+					else {
+						std::lock_guard<std::mutex> lck(gets_mtx);
+						bReturn=true;
+						gets_cv.notify_all();
+					}
 				case '\t':
 					break;
 				default:
@@ -123,76 +157,143 @@ void Fl_Term::write(const char *buf, int len) //send text to host
 	}
 }
 char *Fl_Term::gets(const char *prompt, int echo)	//get user input for host
-{
+{//woken up by write() when return pressed, times out after 60 idle seconds
 	disp(prompt);
+	if ( bHeadless ) return NULL;	//no keyboard, e.g. batch mode
+	std::unique_lock<std::mutex> lck(gets_mtx);
 	cursor=0;
+	bAsk = false;
 	bGets = true;
 	bReturn = false;
 	bPassword = !echo;
-	int old_cursor = cursor;
-	for ( int i=0; i<600&&bGets&&(!bReturn); i++ ) {
-		if ( cursor>old_cursor ) { 
-			old_cursor=cursor;
-			i=0;
+	int old_cursor = cursor, idle = 0;
+	while ( bGets && !bReturn && idle<60 ) {
+		if ( gets_cv.wait_for(lck, std::chrono::seconds(1))
+									==std::cv_status::timeout ) {
+			if ( cursor!=old_cursor ) {
+				old_cursor = cursor;
+				idle = 0;
+			}
+			else
+				idle++;
 		}
-		Sleep(100);
 	}
 	bGets = false;
 	return bReturn?keys:NULL;
 }
+void Fl_Term::ask(const char *prompt, int echo)	//gets() without waiting
+{
+	disp(prompt);
+	std::lock_guard<std::mutex> lck(gets_mtx);
+	cursor=0;
+	bReturn = false;
+	bPassword = !echo;
+	bAsk = true;
+	bGets = true;
+}
 void Fl_Term::disconn()
 {
-	bGets = false;
+	gets_mtx.lock();
+	bGets = bAsk = false;
+	gets_cv.notify_all();
+	gets_mtx.unlock();
 	host->disconn();
 }
 
 Fl_Term::Fl_Term(int X,int Y,int W,int H,const char *L) : Fl_Widget(X,Y,W,H,L)
+{
+	bHeadless = false;
+	init();
+
+	textfont(FL_COURIER);
+	textsize(16);
+	size_x = w()/font_width;
+	size_y = h()/font_height;
+	roll_top = 0;
+	roll_bot = size_y-1;
+	color(FL_BLACK);
+}
+Fl_Term::Fl_Term(int cols, int rows) : Fl_Widget(0, 0, cols, rows)
+{
+	bHeadless = true;		//one character per pixel, never shown
+	init();
+
+	font_face = FL_COURIER;
+	font_size = 1;
+	font_width = 1;
+	font_height = 1;
+	size_x = cols;
+	size_y = rows;
+	roll_top = 0;
+	roll_bot = size_y-1;
+}
+void Fl_Term::init()
 {
 	bEcho = false;
+	bWait = false;
 	bScrollbar = false;
 	host = new HOST();
 
 	*sTitle = 0;
 	strcpy(sPrompt, "> ");
 	iPrompt = 2;
+	patterns.push_back("--More--");
+	pattern_acts.push_back(PROMPT_SPACE);
+	patterns.push_back("[confirm]");
+	pattern_acts.push_back(PROMPT_YES);
+	const char *errors[] = { "% Invalid", "% Incomplete", "% Ambiguous",
+							 "error:", "Error:" };
+	for ( int i=0; i<5; i++ ) {
+		patterns.push_back(errors[i]);
+		pattern_acts.push_back(PROMPT_ERROR);
+	}
+	iWindow = 1;
+	build_patterns();
 	iTimeOut = 30;
 	bDND = false;
 	bScriptRun = bScriptPause = false;
 	fpLogFile = NULL;
 	LogFileName = NULL;
+	fpRecord = NULL;
+	bReplay = false;
+	tap_cb = NULL;
+	tap_data = NULL;
 
 	line = NULL;
 	buff = attr = NULL;
+	view_end = 0;
+	blocks_dropped = 0;
 	clear();
-
-	textfont(FL_COURIER);
-	textsize(16);
-	size_x = w()/font_width;
-	size_y = h()/font_height;
-	roll_top = 0;
-	roll_bot = size_y-1;
-	color(FL_BLACK);
 }
 Fl_Term::~Fl_Term()
 {
+	if ( fpRecord!=NULL ) fclose(fpRecord);
 	delete host;
 	free(attr);
-	free(buff);
 	free(line);
 };
 void Fl_Term::clear()
 {
 	Fl::lock();
 	line_size = 4096;
+	buff_move(4096*64, 0, 0);
 	buff_size = 4096*64;
-	buff = (char *)realloc(buff, buff_size);
 	attr = (char *)realloc(attr, buff_size);
 	line = (int * )realloc(line, line_size*sizeof(int));
 	if ( line!=NULL ) memset(line, 0, line_size*sizeof(int) );
-	if ( buff!=NULL ) memset(buff, 0, buff_size);
 	if ( attr!=NULL ) memset(attr, 0, buff_size);
 	cursor_y = cursor_x = 0;
 	screen_y = 0;
+	erased_lines = 0;
+	erased_chars = 0;
+	blocks_dropped += blocks.size();
+	blocks.clear();
+	block_idx.clear();
+	pipe_sent = pipe_done = 0;
+	pipe_first = -1;
+	pipe_window = 1;
+	pipe_clean = 0;
+	pipe_lost = false;
 	sel_left = sel_right= 0;
 	c_attr = 7;//default black background, white foreground
 	recv0 = 0;
@@ -203,6 +304,14 @@ void Fl_Term::clear()
 	bScrollbar = false;
 	bCursor = true;
 	bPrompt = true;
+	bTimedOut = bReplyError = false;
+	bAbort = false;
+	reply0 = 0;
+	ac_state = 0;
+	match_x = -1;
+	bMarks = false;
+	mark_last = 0;
+	mark_x = -1;
 	memset(tabstops, 0, 256);
 	for ( int i=0; i<256; i+=8 ) tabstops[i]=1;
 
@@ -226,6 +335,7 @@ void Fl_Term::resize(int X, int Y, int W, int H)
 void Fl_Term::textfont(Fl_Font fontface)
 {
 	font_face = fontface;
+	if ( bHeadless ) return;
 	fl_font(font_face, font_size);
 	font_width = fl_width("abcdefghij")/10;
 	font_height = fl_height();
@@ -233,6 +343,7 @@ void Fl_Term::textfont(Fl_Font fontface)
 void Fl_Term::textsize(int fontsize)
 {
 	font_size = fontsize;
+	if ( bHeadless ) return;
 	fl_font(font_face, font_size);
 	font_width = fl_width("abcdefghij")/10;
 	font_height = fl_height();
@@ -450,13 +561,25 @@ int Fl_Term::handle(int e)
 					redraw();
 				}
 				break;
-			case FL_Up:	  host->write(bAppCursor?"\033OA":"\033[A",3); break;
-			case FL_Down: host->write(bAppCursor?"\033OB":"\033[B",3); break;
+			case FL_Up:
+				if ( Fl::event_state(FL_CTRL) && !bAltScreen )
+					jump_prompt(-1);		//previous command
+				else
+					host->write(bAppCursor?"\033OA":"\033[A",3);
+				break;
+			case FL_Down:
+				if ( Fl::event_state(FL_CTRL) && !bAltScreen )
+					jump_prompt(1);			//next command
+				else
+					host->write(bAppCursor?"\033OB":"\033[B",3);
+				break;
 			case FL_Right:host->write(bAppCursor?"\033OC":"\033[C",3); break;
 			case FL_Left: host->write(bAppCursor?"\033OD":"\033[D",3); break;
 			case FL_BackSpace: write("\177", 1); break;
 			case FL_Pause: pause_script(); break;
 			case FL_Enter:
+			case FL_KP_Enter:
+				mark_command(NULL);
 			default:
 				write(Fl::event_text(), Fl::event_length());
 				if ( screen_y < cursor_y-size_y+1 )
@@ -475,22 +598,19 @@ void Fl_Term::next_line()
 	if ( cursor_x>buff_size-1024 || cursor_y>line_size-3 ) {
 		Fl::lock();
 		if ( line_size<65536 ) {	//double buffer size till 64k lines
-			char *old_buff = buff;
 			char *old_attr = attr;
 			int *old_line = line;
-			buff = (char *)realloc(buff, buff_size*2);
+			bool moved = buff_move(buff_size*2, 0, buff_size);
 			attr = (char *)realloc(attr, buff_size*2);
 			line = (int  *)realloc(line, (line_size*2)*sizeof(int));
-			if ( buff!=NULL && attr!=NULL && line!=NULL ) {
+			if ( moved && attr!=NULL && line!=NULL ) {
 				memset(line+line_size, 0, line_size*sizeof(int));
-				memset(buff+buff_size, 0, buff_size);
 				memset(attr+buff_size, 0, buff_size);
 				buff_size*=2;
 				line_size*=2;
 			}
 			else {//clear buffer if failed to double
 				if ( attr==NULL ) attr = old_attr;
-				if ( buff==NULL ) buff = old_buff;
 				if ( line==NULL ) line = old_line;
 				clear();
 			}
@@ -502,16 +622,57 @@ void Fl_Term::next_line()
 			memset(line+32768, 0, 32768*sizeof(int));
 			screen_y-=32768; if ( screen_y<0 ) screen_y=0;
 			cursor_y-=32768;
+			erased_lines+=32768;
+			erased_chars+=middle;
+			blocks_trim();
+			match_x-=middle;
+			mark_x-=middle; if ( mark_x<0 ) mark_x=-1;
 			cursor_x-=middle;
 			recv0-=middle; if ( recv0<0 ) recv0=0;
 			memmove(attr, attr+middle, line[cursor_y+1]);
 			memset(attr+line[cursor_y+1], 0, 65536*64-line[cursor_y+1]);
-			memmove(buff, buff+middle, line[cursor_y+1]);
-			memset(buff+line[cursor_y+1], 0, 65536*64-line[cursor_y+1]);
+			if ( !buff_move(buff_size, middle, line[cursor_y+1]) )
+				clear();	//views still hold the buffer, can't move in it
 		}
 		Fl::unlock();
 	}
 }
+bool Fl_Term::buff_move(int size, int from, int len)
+{//move len chars at from to the start of a buffer of size, in place unless
+ //REPLY views still hold the buffer, then they keep the old one to themselves
+	if ( buff!=NULL && size==buff_size && buff_block.use_count()==1 ) {
+		memmove(buff, buff+from, len);
+		memset(buff+len, 0, size-len);
+		view_end = 0;
+		return true;
+	}
+	char *p = (char *)malloc(size);
+	if ( p==NULL ) return false;
+	if ( len>0 ) memcpy(p, buff+from, len);
+	memset(p+len, 0, size-len);
+	buff_block.reset(p, free);
+	buff = p;
+	view_end = 0;
+	return true;
+}
+void Fl_Term::buff_unshare()
+{//copy on write, called by buff_write() before chars under a view change
+	if ( buff_block.use_count()==1 )
+		view_end = 0;						//views are all released
+	else
+		buff_move(buff_size, 0, buff_size);	//fails only when out of memory
+}
+int Fl_Term::view(REPLY *reply, int start, int end)
+{//call with append_mtx locked, the view stays valid after the lock is released
+ //and never changes, chars under it are copied on write by buff_write()
+	if ( reply!=NULL ) {
+		reply->block = buff_block;
+		reply->data = buff+start;
+		reply->len = end-start;
+		if ( end>view_end ) view_end = end;
+	}
+	return end-start;
+}
 void Fl_Term::append( const char *newtext, int len )
 {
 	const unsigned char *p = (const unsigned char *)newtext;
@@ -537,7 +698,7 @@ void Fl_Term::append( const char *newtext, int len )
 			case 0x00:
 			case 0x0e:
 			case 0x0f:	break;
-			case 0x07:	fl_beep(FL_BEEP_DEFAULT); break;
+			case 0x07:	if ( !bHeadless ) fl_beep(FL_BEEP_DEFAULT); break;
 			case 0x08:
 				if ( cursor_x>line[cursor_y] ) {
 					if ( (buff[cursor_x--]&0xc0)==0x80 )//utf8 continuation byte
@@ -547,6 +708,7 @@ void Fl_Term::append( const char *newtext, int len )
 				break;
 			case 0x09:{
 				int l;
+				buff_write(cursor_x);
 				do {
 					attr[cursor_x]=c_attr;
 					buff[cursor_x++]=' ';
@@ -562,10 +724,12 @@ void Fl_Term::append( const char *newtext, int len )
 				}
 				else {	//LF and newline
 					cursor_x = line[cursor_y+1]	;
+					buff_write(cursor_x);
 					attr[cursor_x] = c_attr;
 					buff[cursor_x++] = 0x0a;
 					next_line();
 				}
+				ac_state = ac_next[ac_state*256+0x0a];
 				break;
 			case 0x0d:
 				if ( cursor_x-line[cursor_y]==size_x+1 && *p!=0x0a )
@@ -624,21 +788,106 @@ void Fl_Term::append( const char *newtext, int len )
 						cursor_x--;
 				}
 			}
+			buff_write(cursor_x);
 			attr[cursor_x] = c_attr;
 			buff[cursor_x++] = c;
 			if ( line[cursor_y+1]<cursor_x )
 				line[cursor_y+1]=cursor_x;
+			ac_state = ac_next[ac_state*256+c];
+			if ( ac_act[ac_state]!=PROMPT_NONE ) {
+				match_x = cursor_x;
+				match_act = ac_act[ac_state];
+				if ( match_act==PROMPT_ERROR && !bPrompt ) bReplyError = true;
+				if ( pipe_done<pipe_sent ) {	//count prompts when pipelining
+					CMD_BLOCK &b = blocks[pipe_done];
+					if ( match_act==PROMPT_ERROR ) b.error = true;
+					if ( match_act==PROMPT_DONE && !bMarks
+							&& pipe_sent-pipe_done>1 ) {
+						echo_check();
+						block_done();
+						match_x = -1;	//counted, the last one in flight is
+					}					//only counted at the end of output
+				}
+			}
 		}
 	}
-	if ( !bPrompt && cursor_x>iPrompt ) {
-		char *p=buff+cursor_x-iPrompt;
-		if ( strncmp(p, sPrompt, iPrompt)==0 ) bPrompt=true;
+	if ( match_x==cursor_x && match_act==PROMPT_DONE && iPrompt>0
+									&& !bMarks && pipe_done<pipe_sent )
+		block_done();
+	const char *reply = NULL;	//only act on a match at the end of output,
+	if ( !bPrompt || (pipe_first!=-1 && pipe_done<pipe_sent) ) {//and only
+													//while a script waits
+		if ( iPrompt==0 || match_x==cursor_x ) {
+			switch ( iPrompt==0 ? PROMPT_DONE : match_act ) {
+			case PROMPT_DONE: if ( bMarks && iPrompt>0 && mark_last=='C' ) {
+								bMarks = false;	//prompt of a host without
+								if ( pipe_done<pipe_sent ) block_done();
+							}					//marks, e.g. ssh from a shell
+							if ( bMarks && pipe_done<pipe_sent ) break;
+							bPrompt=true;	//with marks, D ends the reply
+							prompt_cv.notify_all(); break;
+			case PROMPT_SPACE: reply = " "; break;
+			case PROMPT_YES:   reply = "y"; break;
+			}
+			match_x = -1;
+		}
 	}
+	if ( bWait ) prompt_cv.notify_all();
 	redraw_pending=true;
 	append_mtx.unlock();
+	if ( reply!=NULL ) host->write(reply, 1);
+}
+void Fl_Term::build_patterns()
+{//compile sPrompt and patterns into one automaton, called with append_mtx held
+	std::vector<std::string> pats(1, sPrompt);
+	std::vector<char> acts(1, PROMPT_DONE);
+	pats.insert(pats.end(), patterns.begin(), patterns.end());
+	acts.insert(acts.end(), pattern_acts.begin(), pattern_acts.end());
+
+	ac_next.assign(256, 0);		//trie of all patterns, -1 for no edge
+	for ( int i=0; i<256; i++ ) ac_next[i] = -1;
+	ac_act.assign(1, PROMPT_NONE);
+	for ( size_t i=0; i<pats.size(); i++ ) {
+		int s = 0;
+		for ( size_t j=0; j<pats[i].size(); j++ ) {
+			unsigned char c = pats[i][j];
+			if ( ac_next[s*256+c]==-1 ) {
+				ac_next[s*256+c] = ac_act.size();
+				ac_next.resize(ac_next.size()+256, -1);
+				ac_act.push_back(PROMPT_NONE);
+			}
+			s = ac_next[s*256+c];
+		}
+		if ( s!=0 && ac_act[s]==PROMPT_NONE ) ac_act[s] = acts[i];
+	}
+
+	std::vector<int> fail(ac_act.size(), 0), queue;
+	for ( int c=0; c<256; c++ ) {	//breadth first, fill in the missing edges
+		int t = ac_next[c];
+		if ( t==-1 )
+			ac_next[c] = 0;
+		else
+			queue.push_back(t);
+	}
+	for ( size_t q=0; q<queue.size(); q++ ) {
+		int s = queue[q];
+		if ( ac_act[s]==PROMPT_NONE ) ac_act[s] = ac_act[fail[s]];
+		for ( int c=0; c<256; c++ ) {
+			int t = ac_next[s*256+c];
+			if ( t==-1 )
+				ac_next[s*256+c] = ac_next[fail[s]*256+c];
+			else {
+				fail[t] = ac_next[fail[s]*256+c];
+				queue.push_back(t);
+			}
+		}
+	}
+	ac_state = 0;
+	match_x = -1;
 }
 void Fl_Term::buff_clear(int offset, int len)
 {
+	buff_write(offset);
 	memset(buff+offset, ' ', len);
 	memset(attr+offset,   7, len);
 }
@@ -821,6 +1070,7 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 					}
 					break;
 				case 'L': //insert n0 lines
+					buff_write(line[cursor_y]);
 					if ( n0 > screen_y+roll_bot-cursor_y )
 						n0 = screen_y+roll_bot-cursor_y+1;
 					else
@@ -832,6 +1082,7 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 					buff_clear(cursor_x, size_x*n0);
 					break;
 				case 'M': //delete n0 lines
+					buff_write(line[cursor_y]);
 					if ( n0 > screen_y+roll_bot-cursor_y )
 						n0 = screen_y+roll_bot-cursor_y+1;
 					else
@@ -843,6 +1094,7 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 					buff_clear(line[screen_y+roll_bot-n0+1], size_x*n0);
 					break;
 				case 'P': //delete n0 characters
+					buff_write(cursor_x);
 					for ( int i=cursor_x+n0; i<line[cursor_y+1]; i++ ) {
 						buff[i-n0]=buff[i];
 						attr[i-n0]=attr[i];
@@ -855,6 +1107,7 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 					}
 					break;
 				case '@': //insert n0 spaces
+					buff_write(cursor_x);
 					for ( int i=line[cursor_y+1]-n0-1; i>=cursor_x; i-- ){
 						buff[i+n0]=buff[i];
 						attr[i+n0]=attr[i];
@@ -872,6 +1125,7 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 				case 'Z': //cursor backward n0 tab stops
 					break;
 				case 'S': // scroll up n0 lines
+					buff_write(line[screen_y+roll_top]);
 					for ( int i=roll_top; i<=roll_bot-n0; i++ ) {
 						memcpy( buff+line[screen_y+i],
 								buff+line[screen_y+i+n0], size_x);
@@ -881,6 +1135,7 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 					buff_clear(line[screen_y+roll_bot-n0+1], n0*size_x);
 					break;
 				case 'T': // scroll down n0 lines
+					buff_write(line[screen_y+roll_top]);
 					for ( int i=roll_bot; i>=roll_top+n0; i-- ) {
 						memcpy( buff+line[screen_y+i],
 								buff+line[screen_y+i-n0], size_x);
@@ -1008,6 +1263,7 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 			else {								//scroll
 				int len = line[screen_y+roll_bot+1]-line[screen_y+roll_top+1];
 				int x = cursor_x-line[cursor_y];
+				buff_write(line[screen_y+roll_top]);
 				memcpy(buff+line[screen_y+roll_top], 
 						buff+line[screen_y+roll_top+1], len);
 				memcpy(attr+line[screen_y+roll_top], 
@@ -1027,6 +1283,7 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 				cursor_x = line[--cursor_y]+x;
 			}
 			else {								//scroll
+				buff_write(line[screen_y+roll_top]);
 				for ( int i=roll_bot; i>roll_top; i-- ) {
 					memcpy(buff+line[screen_y+i],buff+line[screen_y+i-1],size_x);
 					memcpy(attr+line[screen_y+i],attr+line[screen_y+i-1],size_x);
@@ -1040,7 +1297,16 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 			bEscape = false;
 			break;
 		case ']': //set window title
-			if ( ESC_code[ESC_idx-1]==';' ) {
+			if ( strncmp(ESC_code, "]133;", 5)==0 ) {//semantic prompt marks
+				if ( sz[-1]==0x07 || ESC_code[ESC_idx-1]=='\\' ) {
+					if ( sz[-1]!=0x07 ) ESC_code[ESC_idx-1] = 0;
+					semantic_mark(ESC_code[5], ESC_code+6);
+					bEscape = false;
+				}
+				else if ( ESC_idx>24 )	//only the mark and exit code matter
+					ESC_idx = 24;
+			}
+			else if ( ESC_code[ESC_idx-1]==';' ) {
 				if ( ESC_code[1]=='0' ) {
 					bTitle = true;
 					title_idx = 0;
@@ -1057,8 +1323,10 @@ const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
 			break;
 		case '#':
 			if ( ESC_idx==2 ) {
-				if ( ESC_code[1]=='8' )
+				if ( ESC_code[1]=='8' ) {
+					buff_write(line[screen_y]);
 					memset(buff+line[screen_y], 'E', size_x*size_y);
+				}
 				bEscape = false;
 			}
 			break;
@@ -1092,20 +1360,223 @@ void Fl_Term::logg(const char *fn)
 	}
 	disp("***\033[37m\r\n");
 }
-void Fl_Term::save(const char *fn)
+void Fl_Term::record(const char *fn)
 {
-	FILE *fp = fl_fopen(fn, "wb");
+	append_mtx.lock();	//puts() writes to fpRecord with append_mtx locked
+	FILE *fp = fpRecord;
+	fpRecord = NULL;
+	append_mtx.unlock();
 	if ( fp!=NULL ) {
-		for (int i=0; i<cursor_x; i+=8192) {
-			int len = i+8192<cursor_x ? 8192 : cursor_x-i;
-			fwrite(buff+i, 1, len, fp);
+		fclose(fp);
+		disp("\r\n\033[32m***recording off");
+	}
+	else {
+		fp = fl_fopen(fn, "wb");
+		if ( fp!=NULL ) {
+			fprintf(fp, "FLTerm-rec 1 %dx%d\n", size_x, size_y);
+			record_start = clock_secs();
+			append_mtx.lock();
+			fpRecord = fp;
+			append_mtx.unlock();
+			disp("\r\n\033[32m***recording to ");
+			disp(fn);
 		}
+		else {
+			disp("\r\n\033[31m***Failed to open record file");
+		}
+	}
+	disp("***\033[37m\r\n");
+}
+/*recording file starts with a line "FLTerm-rec 1 80x25", followed by
+  one record for each chunk received from host: a line of "seconds length",
+  the raw bytes of the chunk, then a line feed.
+  speed is the factor of playback rate, 0 to play as fast as possible
+*/
+int Fl_Term::replay(const char *fn, double speed, long *bytes, double *secs)
+{
+	*bytes = 0;
+	*secs = 0;
+	FILE *fp = fl_fopen(fn, "rb");
+	if ( fp==NULL ) return -1;
+
+	char hdr[256];
+	if ( fgets(hdr, 256, fp)==NULL || strncmp(hdr, "FLTerm-rec ", 11)!=0 ) {
 		fclose(fp);
-		char msg[256];
-		snprintf(msg, 256, "\r\n\033[32m***%d bytes saved to %s***\03337m\r\n",
-				cursor_x, fn);
+		return -1;
+	}
+	int cols, rows;
+	if ( bHeadless && sscanf(hdr+11, "%*d %dx%d", &cols, &rows)==2 ) {
+		size_x = cols;
+		size_y = rows;
+		roll_bot = size_y-1;
+	}
+
+	int frames = 0, len, buf_size = 32768;
+	char *buf = (char *)malloc(buf_size);
+	double t, start = clock_secs();
+	bReplay = true;
+	while ( bReplay && fgets(hdr, 256, fp)!=NULL ) {
+		if ( sscanf(hdr, "%lf %d", &t, &len)!=2 || len<=0 ) break;
+		if ( len>buf_size ) {
+			char *p = (char *)realloc(buf, len);
+			if ( p==NULL ) break;
+			buf = p;
+			buf_size = len;
+		}
+		if ( (int)fread(buf, 1, len, fp)!=len ) break;
+		fgetc(fp);			//line feed after each chunk
+		if ( speed>0 ) {
+			double delay = t/speed-(clock_secs()-start);
+			if ( delay>0 ) Sleep((int)(delay*1000));
+		}
+		puts(buf, len);
+		*bytes += len;
+		frames++;
+	}
+	bReplay = false;
+	*secs = clock_secs()-start;
+	free(buf);
+	fclose(fp);
+	return frames;
+}
+void Fl_Term::replayer(char *params)	//"file [speed]"
+{
+	double speed = 1;
+	char *p = strrchr(params, ' ');
+	if ( p!=NULL && (isdigit(p[1]) || p[1]=='.') ) {
+		speed = atof(p+1);
+		*p = 0;
+	}
+
+	long bytes;
+	double secs;
+	char msg[1024];
+	int frames = replay(params, speed, &bytes, &secs);
+	if ( frames<0 )
+		snprintf(msg, 1024, "\r\n\033[31m***couldn't replay %s***\033[37m\r\n",
+					params);
+	else
+		snprintf(msg, 1024, "\r\n\033[32m***replayed %d frames, %ld bytes "
+					"in %.3fs, %.2fMB/s***\033[37m\r\n", frames, bytes, secs,
+					secs>0 ? bytes/secs/1048576 : 0.0);
+	disp(msg);
+	free(params);
+}
+void Fl_Term::save(const char *fn)
+{
+	std::thread exportThread(&Fl_Term::exporter, this, strdup(fn));
+	exportThread.detach();
+}
+enum { EXPORT_TEXT=0, EXPORT_HTML, EXPORT_ANSI };
+static const char *HTML_colors[] = {
+	"000000", "c00000", "00c000", "c0c000",
+	"2060c0", "c000c0", "00c0c0", "c0c0c0",
+	"000000", "ff0000", "00ff00", "ffff00",
+	"0000ff", "ff00ff", "00ffff", "ffffff"
+};
+int Fl_Term::export_lines(char *out, int size, int *py, int end, int fmt)
+{//format lines from *py till end or out is full, called with append_mtx locked
+	int len = 0;
+	int y = *py;
+	while ( y<end && y<=cursor_y ) {
+		int a = line[y];
+		int z = line[y+1];
+		if ( z>cursor_x ) z = cursor_x;
+		if ( len>0 && len+(z-a)*40+64>size ) break;
+		int last = -1;		//attribute of the open span/color
+		for ( int i=a; i<z && len<size-64; i++ ) {
+			char c = buff[i];
+			if ( c==0 ) continue;
+			if ( c==0x0a ) break;
+			if ( fmt!=EXPORT_TEXT && attr[i]!=last ) {
+				int fg = attr[i]&0x0f;
+				int bg = (attr[i]>>4)&0x0f;
+				if ( fmt==EXPORT_HTML ) {
+					if ( last!=-1 ) len += snprintf(out+len, size-len, "</span>");
+					len += snprintf(out+len, size-len,
+									"<span class=\"f%d b%d\">", fg, bg);
+				}
+				else
+					len += snprintf(out+len, size-len, "\033[0;%d;%dm",
+									(fg&8?90:30)+(fg&7), (bg&8?100:40)+(bg&7));
+				last = attr[i];
+			}
+			if ( fmt==EXPORT_HTML && (c=='<' || c=='>' || c=='&') )
+				len += snprintf(out+len, size-len,
+								c=='<' ? "&lt;" : (c=='>' ? "&gt;" : "&amp;"));
+			else
+				out[len++] = c;
+		}
+		if ( last!=-1 )
+			len += snprintf(out+len, size-len,
+							fmt==EXPORT_HTML ? "</span>" : "\033[0m");
+		if ( z>a && buff[z-1]==0x0a ) out[len++] = 0x0a;
+		y++;
+	}
+	*py = y;
+	return len;
+}
+void Fl_Term::exporter(char *fn)
+{//export scroll back buffer as text, or html/ansi with colors, line by line
+	int fmt = EXPORT_TEXT;
+	const char *ext = strrchr(fn, '.');
+	if ( ext!=NULL ) {
+		if ( strcmp(ext, ".html")==0 || strcmp(ext, ".htm")==0 )
+			fmt = EXPORT_HTML;
+		if ( strcmp(ext, ".ans")==0 ) fmt = EXPORT_ANSI;
+	}
+	char msg[1024];
+	FILE *fp = fl_fopen(fn, "wb");
+	if ( fp==NULL ) {
+		snprintf(msg, 1024, "\r\n\033[31m***couldn't open %s***\033[37m\r\n", fn);
 		disp(msg);
+		free(fn);
+		return;
+	}
+	if ( fmt==EXPORT_HTML ) {
+		fprintf(fp, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">");
+		fprintf(fp, "<title>%s</title>\n<style>\n", sTitle);
+		fprintf(fp, "body{background:#000} pre{font-family:monospace}\n");
+		for ( int i=0; i<16; i++ )
+			fprintf(fp, ".f%d{color:#%s} .b%d{background:#%s}\n",
+						i, HTML_colors[i], i, HTML_colors[i]);
+		fprintf(fp, "</style></head>\n<body><pre>");
+	}
+
+	append_mtx.lock();
+	int y = erased_lines;				//absolute line numbers, so that
+	int end = erased_lines+cursor_y+1;	//erasing at 64k lines is tracked
+	append_mtx.unlock();
+
+	const int size = 256*1024;			//write in large blocks
+	char *out = (char *)malloc(size);
+	int start = y, percent = -1;
+	snprintf(msg, 1024, "\r\n\033[32m***exporting to %s    ", fn);
+	disp(msg);
+	while ( out!=NULL && y<end ) {
+		append_mtx.lock();
+		if ( y<erased_lines ) y = erased_lines;	//dropped while exporting
+		int ly = y-erased_lines;
+		int len = export_lines(out, size, &ly, end-erased_lines, fmt);
+		bool progress = ly+erased_lines>y;
+		y = ly+erased_lines;
+		append_mtx.unlock();
+		if ( !progress ) break;		//buffer cleared while exporting
+		if ( fwrite(out, 1, len, fp)!=(size_t)len ) break;
+		int pct = (int)(100LL*(y-start)/(end-start));
+		if ( pct!=percent ) {
+			percent = pct;
+			snprintf(msg, 1024, "\033[4D%3d%%", pct);
+			disp(msg);
+		}
 	}
+	if ( fmt==EXPORT_HTML ) fprintf(fp, "</pre></body></html>\n");
+	fclose(fp);
+	free(out);
+	snprintf(msg, 1024, "\r\n\033[32m***%d lines saved to %s***\033[37m\r\n",
+				y-start, fn);
+	disp(msg);
+	free(fn);
 }
 void Fl_Term::srch(const char *sstr)
 {
@@ -1128,38 +1599,169 @@ void Fl_Term::srch(const char *sstr)
 }
 void Fl_Term::learn_prompt()
 {//capture prompt for scripting
+	std::lock_guard<std::mutex> lck(append_mtx);
 	if ( cursor_x>1 ) {
 		sPrompt[0] = buff[cursor_x-2];
 		sPrompt[1] = buff[cursor_x-1];
 		sPrompt[2] = 0;
 		iPrompt = 2;
+		build_patterns();
 	}
 }
 int Fl_Term::mark_prompt()
 {
 	bPrompt = false;
+	bReplyError = false;
+	reply0 = erased_chars+cursor_x;
 	return recv0=cursor_x;
 }
-int Fl_Term::waitfor_prompt()
-{
-	int oldlen = recv0;
-	for ( int i=0; i<iTimeOut*10 && !bPrompt; i++ ) {
-		Sleep(100);
-		if ( cursor_x>oldlen ) { i=0; oldlen=cursor_x; }
+int Fl_Term::waitfor_prompt(REPLY *reply)
+{//woken up by append() when prompt found, times out after iTimeOut idle secs
+	double t0 = clock_secs();
+	std::unique_lock<std::mutex> lck(append_mtx);
+	int oldlen = recv0, idle = 0;
+	while ( !bPrompt && !bAbort && idle<iTimeOut ) {
+		if ( prompt_cv.wait_for(lck, std::chrono::seconds(1))
+										==std::cv_status::timeout ) {
+			if ( cursor_x!=oldlen ) {
+				oldlen = cursor_x;
+				idle = 0;
+			}
+			else
+				idle++;
+		}
 	}
+	bTimedOut = !bPrompt;
 	bPrompt = true;
-	return cursor_x - recv0;
+	stats.prompt_wait.observe(clock_secs()-t0);
+	return view(reply, recv0, cursor_x);
 }
-int Fl_Term::command(const char *cmd, const char **preply)
+void Fl_Term::abort_wait(bool abort)
+{//set to stop the wait of the command running, cleared before the next one
+	std::lock_guard<std::mutex> lck(append_mtx);
+	bAbort = abort;
+	prompt_cv.notify_all();
+}
+int Fl_Term::recv_reply(REPLY *reply)
 {
+	std::lock_guard<std::mutex> lck(append_mtx);
+	return view(reply, recv0, cursor_x);
+}
+int Fl_Term::expect(const char *alts, int secs, REPLY *reply)
+{//match "re1 || re2" against lines received since recv0, complete lines are
+ //scanned once, only the last incomplete line is matched again on wakeup
+	std::vector<std::regex> res;
+	const char *p = alts;
+	while ( *p ) {
+		const char *q = strstr(p, " || ");
+		std::string re = q==NULL ? std::string(p) : std::string(p, q-p);
+		try {
+			res.push_back(std::regex(re));
+		}
+		catch ( std::regex_error &e ) {
+			disp("\r\n\033[31m***bad regex ");
+			disp(re.c_str());
+			disp("***\033[37m\r\n");
+			return 0;
+		}
+		if ( q==NULL ) break;
+		p = q+4;
+	}
+
+	auto deadline = std::chrono::steady_clock::now()+std::chrono::seconds(secs);
+	std::unique_lock<std::mutex> lck(append_mtx);
+	long scan = erased_chars+recv0;			//absolute, survives erasing
 	int rc = 0;
+	bWait = true;
+	while ( bWait ) {
+		if ( scan<erased_chars ) scan = erased_chars;
+		const char *line0 = buff+(scan-erased_chars);
+		const char *zz = buff+cursor_x;
+		while ( line0<=zz ) {
+			const char *line1 = (const char *)memchr(line0, 0x0a, zz-line0);
+			if ( line1==NULL ) line1 = zz;		//incomplete last line
+			std::cmatch m;
+			for ( size_t i=0; i<res.size(); i++ ) {
+				if ( std::regex_search(line0, line1, m, res[i]) ) {
+					for ( size_t j=0; j<m.size() && j<10; j++ )
+						vars[std::to_string(j)] = m[j].str();
+					vars["expect"] = std::to_string(i+1);
+					reply0 = erased_chars+(line0-buff);
+					recv0 = (line0-buff)+m.position(0)+m.length(0);
+					rc = view(reply, line0-buff, line1-buff);
+					bWait = false;
+					break;
+				}
+			}
+			if ( !bWait || line1==zz ) break;
+			line0 = line1+1;
+			scan = erased_chars+(line0-buff);
+		}
+		if ( bWait && (bAbort || prompt_cv.wait_until(lck, deadline)
+										==std::cv_status::timeout) )
+			break;
+	}
+	bTimedOut = bWait;
+	if ( bWait ) vars["expect"] = "0";
+	bWait = false;
+	return rc;
+}
+int Fl_Term::match(const char *re)
+{//capture groups of regex in the last reply to ${0}..${9}
+	std::string reply;
+	append_mtx.lock();
+	long start = reply0-erased_chars;
+	if ( start<0 ) start = 0;
+	if ( start<cursor_x ) reply.assign(buff+start, cursor_x-start);
+	append_mtx.unlock();
+
+	std::smatch m;
+	try {
+		if ( !std::regex_search(reply, m, std::regex(re)) ) return 0;
+	}
+	catch ( std::regex_error &e ) {
+		disp("\r\n\033[31m***bad regex ");
+		disp(re);
+		disp("***\033[37m\r\n");
+		return 0;
+	}
+	for ( size_t j=0; j<m.size() && j<10; j++ )
+		vars[std::to_string(j)] = m[j].str();
+	return m.size();
+}
+void Fl_Term::expand_vars(const char *cmd, std::string &out)
+{//replace ${name} with script variables, unknown names are kept as is
+	const char *p = cmd, *q;
+	while ( (q=strstr(p, "${"))!=NULL ) {
+		out.append(p, q-p);
+		const char *r = strchr(q, '}');
+		if ( r==NULL ) break;
+		auto it = vars.find(std::string(q+2, r-q-2));
+		if ( it!=vars.end() )
+			out += it->second;
+		else
+			out.append(q, r-q+1);
+		p = r+1;
+	}
+	out += p;
+}
+int Fl_Term::command(const char *cmd, REPLY *reply)
+{
+	int rc = 0;
+	std::string expanded;
+	if ( !vars.empty() && strstr(cmd, "${")!=NULL ) {
+		expand_vars(cmd, expanded);
+		cmd = expanded.c_str();
+	}
 	if ( *cmd!='!' ) {
 		if ( live() ) {
 			mark_prompt();
+			append_mtx.lock();
+			add_block(cmd);
+			append_mtx.unlock();
 			send(cmd);
 			send("\r");
-			rc = waitfor_prompt();
-			if ( preply!=NULL ) *preply = buff+recv0;
+			rc = waitfor_prompt(reply);
 		}
 		else {
 			disp(cmd);
@@ -1171,13 +1773,39 @@ int Fl_Term::command(const char *cmd, const char **preply)
 		if ( p==NULL ) p="";
 		while (*p==' ') p++;
 		
-		if ( strncmp(cmd,"Clear",5)==0 ) clear();
+		if ( strncmp(cmd,"Clear",5)==0 ) {
+			std::lock_guard<std::mutex> lck(append_mtx);
+			clear();
+		}
+		else if ( strncmp(cmd,"Waitfor",7)==0 ) {
+			std::string re;				//literal string as regex
+			for ( const char *q=p; *q; q++ ) {
+				if ( strchr("\\^$.|?*+()[]{}", *q)!=NULL ) re += '\\';
+				re += *q;
+			}
+			rc = expect(re.c_str(), iTimeOut, reply);
+		}
 		else if ( strncmp(cmd,"Wait",4)==0 ) Sleep(atoi(p)*1000);
 		else if ( strncmp(cmd,"Log", 3)==0 ) {
 			mark_prompt();
 			logg( p );
-			rc = cursor_x-recv0;
-			if ( preply!=NULL ) *preply = buff+recv0;
+			rc = recv_reply(reply);
+		}
+		else if ( strncmp(cmd,"Record",6)==0 ) {
+			mark_prompt();
+			record( p );
+			rc = recv_reply(reply);
+		}
+		else if ( strncmp(cmd,"Replay",6)==0 ) {
+			if ( reply==NULL ) {	//from edit line, replay in background
+				std::thread replayThread(&Fl_Term::replayer, this, strdup(p));
+				replayThread.detach();
+			}
+			else {					//from script, wait till replay is done
+				mark_prompt();
+				replayer(strdup(p));
+				rc = recv_reply(reply);
+			}
 		}
 		else if ( strncmp(cmd,"Echo",4)==0 ) {
 			bEcho=!bEcho;
@@ -1185,8 +1813,7 @@ int Fl_Term::command(const char *cmd, const char **preply)
 			disp("\r\n\033[32m***local echo ");
 			disp(bEcho?"on":"off");
 			disp("***\033[37m\r\n");
-			rc = cursor_x-recv0;
-			if ( preply!=NULL ) *preply = buff+recv0;
+			rc = recv_reply(reply);
 		}
 		else if ( strncmp(cmd,"Disp",4)==0 ) {
 			mark_prompt();
@@ -1197,50 +1824,95 @@ int Fl_Term::command(const char *cmd, const char **preply)
 			send(p);
 		}
 		else if ( strncmp(cmd,"Recv",4)==0 ) {
-			if ( preply!=NULL ) *preply = buff+recv0;
-			rc = cursor_x-recv0;
+			std::lock_guard<std::mutex> lck(append_mtx);
+			rc = view(reply, recv0, cursor_x);
 			recv0 = cursor_x;
 		}
 		else if ( strncmp(cmd,"Copy",4)==0 ) {
 			Fl::copy(buff, cursor_x, 1);
 		}
 		else if ( strncmp(cmd,"Hostname",8)==0 ) {
-			if ( preply!=NULL && live() ) {
-				*preply = (char *)host->name();
-				rc = strlen(*preply);
+			if ( reply!=NULL && live() ) {
+				rc = strlen(host->name());
+				reply->copy(host->name(), rc);
 			}
 		}
 		else if ( strncmp(cmd,"Selection",9)==0) {
-			if ( preply!=NULL ) *preply = buff+sel_left;
-			rc = sel_right-sel_left;
+			std::lock_guard<std::mutex> lck(append_mtx);
+			rc = view(reply, sel_left, sel_right);
 		}
 		else if ( strncmp(cmd,"Timeout",7)==0 ) iTimeOut = atoi(p);
+		else if ( strncmp(cmd,"Expect",6)==0 ) {
+			int secs = iTimeOut;
+			if ( isdigit(*p) ) {
+				secs = atoi(p);
+				while ( isdigit(*p) ) p++;
+				while ( *p==' ' ) p++;
+			}
+			rc = expect(p, secs, reply);
+		}
+		else if ( strncmp(cmd,"Match",5)==0 ) rc = match(p);
+		else if ( strncmp(cmd,"History",7)==0 ) rc = history(p, reply);
+		else if ( strncmp(cmd,"Window",6)==0 ) {
+			iWindow = atoi(p);
+			if ( iWindow<1 ) iWindow = 1;
+			rc = iWindow;
+		}
 		else if ( strncmp(cmd,"Prompt", 6)==0 ) {
 			if ( cmd[6]==' ' ) {
+				std::lock_guard<std::mutex> lck(append_mtx);
 				strncpy(sPrompt, cmd+7, 31);
 				sPrompt[31] = 0;
 				fl_decode_uri(sPrompt);
 				iPrompt = strlen(sPrompt);
+				build_patterns();
 			}
 			else 
 				learn_prompt();
-			if ( preply!=NULL ) *preply = sPrompt;
 			rc = iPrompt;
+			if ( reply!=NULL ) reply->copy(sPrompt, rc);
+		}
+		else if ( strncmp(cmd,"Pattern", 7)==0 ) {
+			std::lock_guard<std::mutex> lck(append_mtx);
+			char act = PROMPT_NONE;
+			if ( strncmp(p, "done ", 5)==0 ) act = PROMPT_DONE;
+			if ( strncmp(p, "space ", 6)==0 ) act = PROMPT_SPACE;
+			if ( strncmp(p, "yes ", 4)==0 ) act = PROMPT_YES;
+			if ( strncmp(p, "error ", 6)==0 ) act = PROMPT_ERROR;
+			if ( act!=PROMPT_NONE ) {
+				char pat[64];
+				strncpy(pat, strchr(p, ' ')+1, 63);
+				pat[63] = 0;
+				fl_decode_uri(pat);
+				if ( *pat ) {
+					patterns.push_back(pat);
+					pattern_acts.push_back(act);
+				}
+			}
+			else if ( strncmp(p, "clear", 5)==0 ) {
+				patterns.clear();
+				pattern_acts.clear();
+			}
+			build_patterns();
+			const char *names[] = { "", "done", "space", "yes", "error" };
+			sPatterns = std::string("done ")+sPrompt+"\n";
+			for ( size_t i=0; i<patterns.size(); i++ )
+				sPatterns += std::string(names[(int)pattern_acts[i]])
+										+" "+patterns[i]+"\n";
+			rc = sPatterns.size();
+			if ( reply!=NULL ) reply->copy(sPatterns.c_str(), rc);
 		}
 		else if ( strncmp(cmd,"scp",3)==0
 				||strncmp(cmd,"tun",3)==0 
 				||strncmp(cmd,"xmodem",6)==0 ) {
 			mark_prompt();
 			host->command(cmd);
-			if ( preply!=NULL ) {
-				*preply = buff+recv0;
-				rc = waitfor_prompt();
-			}
+			if ( reply!=NULL ) rc = waitfor_prompt(reply);
 		}
 		else {
 			HOST *host = host_new(cmd);
 			if ( host!=NULL )
-				rc = connect(host, preply);
+				rc = connect(host, reply);
 		}
 	}
 	return rc;
@@ -1309,12 +1981,15 @@ void Fl_Term::copier(char *files)
 	bScriptRun = true; bScriptPause = false;
 	char dst[256]="";
 	if ( host->type()==HOST_SSH ) {
-		const char *p1, *p2;
-		command("pwd", &p2);
-		p1 = strchr(p2, 0x0a);
+		REPLY reply;
+		const char *p1, *p2, *zz;
+		command("pwd", &reply);
+		p2 = reply.data;
+		zz = reply.data+reply.len;
+		p1 = p2==NULL ? NULL : (const char *)memchr(p2, 0x0a, zz-p2);
 		if ( p1!=NULL ) {
 			p2 = p1+1;
-			p1 = strchr(p2, 0x0a);
+			p1 = (const char *)memchr(p2, 0x0a, zz-p2);
 			if ( p1!=NULL ) {
 				strncpy(dst, p2, p1-p2);
 				dst[p1-p2]='/';
@@ -1343,22 +2018,34 @@ void Fl_Term::copier(char *files)
 }
 void Fl_Term::scripter(char *cmds)
 {
-	char *p1=cmds, *p0;
-	const char *reply;
-	bScriptRun = true; bScriptPause = false;
-	while ( bScriptRun && p1!=NULL ) {
-		if ( bScriptPause ) {
-			Sleep(100); 
-		}
-		else {
-			p0 = p1;
-			p1 = strchr(p0, 0x0a);
-			if ( p1!=NULL ) *p1++ = 0;
-			command(p0, &reply);
-		}
+	SCRIPT script;
+	if ( script.compile(cmds)!=-1 )
+		run(&script);
+	else {
+		disp("\r\n\033[31m***script error, ");
+		disp(script.error());
+		disp("***\033[37m\r\n");
 	}
 	free(cmds);
+}
+bool Fl_Term::run(SCRIPT *script, script_exec *exec, void *data)
+{//run a compiled script in this tab, commands go to exec if not NULL,
+ //false if another script is running here
+	if ( bScriptRun ) return false;
+	bScriptRun = true; bScriptPause = false;
+	script->run(this, exec, data);
+	pipeline(NULL);
 	bScriptRun = bScriptPause = false;
+	return true;
+}
+bool Fl_Term::exec(const char *cmd)	//run one command for SCRIPT::run()
+{
+	REPLY reply;
+	if ( iWindow>1 && *cmd!='!' && live() )
+		return pipeline(cmd);
+	pipeline(NULL);
+	command(cmd, &reply);
+	return true;
 }
 void Fl_Term::run_script(const char *s)	//called on drag&drop
 {
@@ -1394,6 +2081,298 @@ void Fl_Term::run_script(const char *s)	//called on drag&drop
 		}
 	}
 }
+bool Fl_Term::pipeline(const char *cmd)
+{//send cmd when less than pipe_window commands are waiting for the prompt,
+ //cmd==NULL waits for all replies, returns false if timed out or stopped
+	std::unique_lock<std::mutex> lck(append_mtx);
+	if ( pipe_first==-1 ) {				//start of a pipelined run
+		if ( cmd==NULL ) return true;
+		close_blocks();
+		pipe_first = pipe_sent;
+		pipe_window = iWindow;
+		pipe_clean = 0;
+		pipe_lost = false;
+	}
+	int limit = cmd==NULL ? 1 : pipe_window;
+	int checked = pipe_done, oldlen = cursor_x, idle = 0;
+	while ( pipe_sent-pipe_done>=limit && idle<iTimeOut && bScriptRun ) {
+		if ( prompt_cv.wait_for(lck, std::chrono::seconds(1))
+										==std::cv_status::timeout ) {
+			if ( cursor_x!=oldlen ) {
+				oldlen = cursor_x;
+				idle = 0;
+			}
+			else
+				idle++;
+		}
+		for ( ; checked<pipe_done; checked++ ) {//adjust window on each reply
+			if ( blocks[checked].error ) {
+				pipe_window = pipe_window>1 ? pipe_window/2 : 1;
+				pipe_clean = 0;
+			}
+			else if ( ++pipe_clean>=pipe_window && pipe_window<iWindow
+														&& !pipe_lost ) {
+				pipe_window++;
+				pipe_clean = 0;
+			}
+		}
+		if ( cmd!=NULL ) limit = pipe_window;
+	}
+	bool ok = pipe_sent-pipe_done<limit;
+	if ( !ok ) pipe_done = pipe_sent;	//give up on the rest if timed out
+	if ( cmd==NULL || !ok ) {
+		int n = pipe_sent-pipe_first, errors = 0;
+		double secs = 0;
+		for ( int i=pipe_first; i<pipe_sent; i++ ) {
+			if ( blocks[i].error ) errors++;
+			if ( blocks[i].end>0 ) secs = blocks[i].done-blocks[pipe_first].sent;
+		}
+		pipe_first = -1;
+		lck.unlock();
+		if ( n>0 ) {
+			char msg[256];
+			snprintf(msg, 256, "\r\n\033[32m***%d commands pipelined in "
+					"%.1f seconds, %d errors%s***\033[37m\r\n", n, secs, errors,
+					ok ? "" : ", timed out");
+			disp(msg);
+		}
+		return ok;
+	}
+	add_block(cmd);
+	bPrompt = false;
+	lck.unlock();
+	send(cmd);
+	send("\r");
+	return true;
+}
+void Fl_Term::close_blocks()
+{//replies still open when a new command is not pipelined end at cursor_x,
+ //e.g. a typed command that never got a prompt back
+	for ( ; pipe_done<pipe_sent; pipe_done++ ) {
+		blocks[pipe_done].end = erased_chars+cursor_x;
+		blocks[pipe_done].done = clock_secs();
+	}
+}
+long Fl_Term::last_block()
+{//id of the command sent last, for block_reply()
+	std::lock_guard<std::mutex> lck(append_mtx);
+	return blocks_dropped+(long)blocks.size()-1;
+}
+int Fl_Term::block_reply(long id, REPLY *reply, bool *error, bool *timed_out)
+{//reply of command id, -1 if it's erased from the buffer
+	std::lock_guard<std::mutex> lck(append_mtx);
+	long i = id-blocks_dropped;
+	if ( i<0 || i>=(long)blocks.size() ) return -1;
+	CMD_BLOCK &b = blocks[i];
+	*error = b.error;
+	*timed_out = b.end==-1;
+	if ( b.output<erased_chars ) return -1;
+	return view(reply, b.output-erased_chars,
+					b.end==-1 ? cursor_x : b.end-erased_chars);
+}
+void Fl_Term::blocks_trim()
+{//drop blocks erased from the buffer, not while a pipelined run counts on
+ //their index, called from next_line() with append_mtx locked
+	if ( pipe_first!=-1 ) return;
+	int n = 0;
+	while ( n<pipe_done && blocks[n].start<erased_chars ) n++;
+	if ( n==0 ) return;
+	blocks.erase(blocks.begin(), blocks.begin()+n);
+	blocks_dropped += n;
+	pipe_sent -= n;
+	pipe_done -= n;
+	block_idx.clear();
+	for ( size_t i=0; i<blocks.size(); i++ )
+		block_idx[blocks[i].cmd].push_back(i);
+}
+void Fl_Term::block_done()
+{//a prompt ends the reply of blocks[pipe_done], with append_mtx locked
+	CMD_BLOCK &b = blocks[pipe_done];
+	b.end = erased_chars+cursor_x;
+	b.done = clock_secs();
+	if ( ++pipe_done<pipe_sent )	//sent before this prompt, starts after it
+		blocks[pipe_done].start = blocks[pipe_done].output = b.end;
+	prompt_cv.notify_all();
+}
+void Fl_Term::echo_check()
+{//a prompt is about to end blocks[pipe_done], its reply should start with
+ //the echo of its command. If not, the window drops to 1 for the rest of
+ //the run, and if the first reply did start with its echo, the prompt
+ //counted before was in the output of the one before, which this one ends
+	CMD_BLOCK &b = blocks[pipe_done];
+	long start = b.start-erased_chars;
+	if ( pipe_lost || pipe_first==-1 || start<0 ) return;
+	const char *p = buff+start, *zz = buff+cursor_x;
+	while ( p<zz && *p==' ' ) p++;
+	const char *cmd = b.cmd.c_str();
+	while ( *cmd==' ' ) cmd++;
+	int n = strlen(cmd);
+	if ( n>8 ) n = 8;			//hosts may redraw a long command line
+	if ( zz-p>=n && strncmp(p, cmd, n)==0 ) return;
+	pipe_window = 1;
+	pipe_lost = true;
+	if ( pipe_done>pipe_first ) pipe_done--;
+}
+void Fl_Term::add_block(const char *cmd)	//call with append_mtx locked
+{
+	if ( pipe_first==-1 ) close_blocks();
+	CMD_BLOCK b;
+	b.cmd = cmd;
+	b.start = b.output = erased_chars+cursor_x;
+	b.end = -1;
+	b.sent = clock_secs();
+	b.done = 0;
+	b.error = false;
+	block_idx[b.cmd].push_back(blocks.size());
+	blocks.push_back(b);
+	pipe_sent++;
+}
+void Fl_Term::mark_command(const char *cmd)
+{//index a command typed or sent from the edit line, cmd==NULL takes the
+ //command from the cursor line, after the prompt
+	if ( !live() || bGets || bAltScreen ) return;
+	std::lock_guard<std::mutex> lck(append_mtx);
+	std::string s;
+	if ( cmd==NULL ) {
+		const char *p = buff+line[cursor_y], *zz = buff+cursor_x;
+		if ( bMarks && mark_x>=0 && mark_x<=cursor_x ) p = buff+mark_x;
+		else for ( const char *q=zz-iPrompt; iPrompt>0 && q>=p; q-- )
+			if ( memcmp(q, sPrompt, iPrompt)==0 ) {
+				p = q+iPrompt;
+				break;
+			}
+		while ( p<zz && *p==' ' ) p++;
+		s.assign(p, zz-p);
+		cmd = s.c_str();
+	}
+	if ( *cmd ) add_block(cmd);
+}
+int Fl_Term::history(const char *arg, REPLY *reply)
+{//"" lists commands, "n" returns reply of command n, "n cmd" returns reply
+ //of the nth run of cmd, n<0 counts from the last
+	std::lock_guard<std::mutex> lck(append_mtx);
+	if ( *arg==0 ) {
+		std::string list;
+		char buf[64];
+		for ( size_t i=0; i<blocks.size(); i++ ) {
+			CMD_BLOCK &b = blocks[i];
+			snprintf(buf, 64, "%d\t%.2f\t", (int)i+1,
+							b.end==-1 ? 0 : b.done-b.sent);
+			list += buf;
+			list += b.cmd;
+			if ( b.error ) list += "\t(error)";
+			if ( b.start<erased_chars ) list += "\t(erased)";
+			list += "\n";
+		}
+		if ( reply!=NULL ) reply->copy(list.c_str(), list.size());
+		return list.size();
+	}
+	int n = atoi(arg);
+	while ( *arg=='-' || isdigit(*arg) ) arg++;
+	while ( *arg==' ' ) arg++;
+	int i = -1;
+	if ( *arg ) {
+		auto it = block_idx.find(arg);
+		if ( it!=block_idx.end() ) {
+			int cnt = it->second.size();
+			if ( n>0 && n<=cnt ) i = it->second[n-1];
+			if ( n<0 && -n<=cnt ) i = it->second[cnt+n];
+		}
+	}
+	else {
+		int cnt = blocks.size();
+		if ( n>0 && n<=cnt ) i = n-1;
+		if ( n<0 && -n<=cnt ) i = cnt+n;
+	}
+	if ( i==-1 || blocks[i].output<erased_chars ) return 0;
+	CMD_BLOCK &b = blocks[i];
+	return view(reply, b.output-erased_chars,
+					b.end==-1 ? cursor_x : b.end-erased_chars);
+}
+int Fl_Term::lines_since(long *pos, REPLY *reply)
+{//view of complete lines from absolute offset *pos, *pos moves past them,
+ //*pos==-1 starts from the current line
+	std::lock_guard<std::mutex> lck(append_mtx);
+	int end = line[cursor_y];
+	if ( *pos==-1 ) *pos = erased_chars+end;
+	int start = *pos<erased_chars ? 0 : *pos-erased_chars;
+	if ( start>=end ) return 0;
+	*pos = erased_chars+end;
+	return view(reply, start, end);
+}
+bool Fl_Term::jump_block(int n)
+{//scroll to command n and select its reply
+	std::lock_guard<std::mutex> lck(append_mtx);
+	if ( n<1 || n>(int)blocks.size() ) return false;
+	CMD_BLOCK &b = blocks[n-1];
+	if ( b.output<erased_chars ) return false;
+	sel_left = b.output-erased_chars;
+	sel_right = b.end==-1 ? cursor_x : b.end-erased_chars;
+	int x = b.start<erased_chars ? sel_left : b.start-erased_chars;
+	int lo = 0, hi = cursor_y;			//last line starting before x
+	while ( lo<hi ) {
+		int mid = (lo+hi+1)/2;
+		if ( line[mid]<=x ) lo = mid; else hi = mid-1;
+	}
+	screen_y = lo;
+	bScrollbar = true;
+	redraw();
+	return true;
+}
+void Fl_Term::jump_prompt(int dir)
+{//Ctrl+Up/Down, scroll to the command before/after the top of screen
+	int n;
+	{
+		std::lock_guard<std::mutex> lck(append_mtx);
+		long top = erased_chars+(!bScrollbar ? cursor_x :
+								line[dir<0 ? screen_y : screen_y+1]);
+		int lo = 0, hi = blocks.size();	//first block starting at or after top
+		while ( lo<hi ) {
+			int mid = (lo+hi)/2;
+			if ( blocks[mid].start<top ) lo = mid+1; else hi = mid;
+		}
+		n = dir<0 ? lo : lo+1;
+	}
+	jump_block(n);
+}
+void Fl_Term::semantic_mark(char mark, const char *arg)
+{//OSC 133 A prompt, B command input, C output, D;exitcode command done,
+ //called from vt100_Escape() with append_mtx locked, marks are used again
+ //once back from a host without them
+	bMarks = true;
+	mark_last = mark;
+	switch ( mark ) {
+	case 'B':
+		mark_x = cursor_x;
+		break;
+	case 'C':
+		if ( pipe_done==pipe_sent && mark_x>=0 && mark_x<=cursor_x ) {
+			std::string cmd(buff+mark_x, cursor_x-mark_x);	//not typed in
+			while ( !cmd.empty() && strchr("\r\n ", cmd.back())!=NULL )//term
+				cmd.pop_back();
+			if ( !cmd.empty() ) {
+				add_block(cmd.c_str());
+				blocks.back().start = erased_chars+mark_x;
+			}
+		}
+		if ( pipe_done<pipe_sent )
+			blocks[pipe_done].output = erased_chars+cursor_x;
+		mark_x = -1;
+		break;
+	case 'D':
+		if ( pipe_done<pipe_sent ) {
+			CMD_BLOCK &b = blocks[pipe_done++];
+			b.end = erased_chars+cursor_x;
+			b.done = clock_secs();
+			if ( *arg==';' && atoi(arg+1)!=0 ) b.error = true;
+			if ( pipe_done<pipe_sent )
+				blocks[pipe_done].start = blocks[pipe_done].output = b.end;
+		}
+		bPrompt = true;
+		prompt_cv.notify_all();
+		break;
+	}
+}
 bool Fl_Term::pause_script()
 {
 	bScriptPause = !bScriptPause;
@@ -1402,6 +2381,7 @@ bool Fl_Term::pause_script()
 void Fl_Term::quit_script()
 {
 	bScriptRun = bScriptPause = false;
+	bReplay = false;
 }
 
 #define TNO_IAC		0xff
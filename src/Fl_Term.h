@@ -17,15 +17,47 @@
 #include <FL/Fl.H>
 #include <FL/fl_draw.H>
 #include "host.h"
+#include "metrics.h"
+#include "script.h"
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
 
 #ifndef _FL_TERM_H_
 #define _FL_TERM_H_
+enum { PROMPT_NONE=0, PROMPT_DONE, PROMPT_SPACE, PROMPT_YES, PROMPT_ERROR };
+
+struct CMD_BLOCK {		//a command typed or sent by script and range of its reply
+	std::string cmd;
+	long start;			//absolute offset of reply, erased_chars+cursor_x
+	long output;		//absolute offset of output after the echo, OSC 133 C
+	long end;			//absolute offset of the next prompt, -1 if not received
+	double sent;		//time the command was sent
+	double done;		//time the prompt was received
+	bool error;			//an error pattern was found in the reply
+};
+struct REPLY {			//reply of command(), a view into the scroll back buffer
+	std::shared_ptr<char> block;//keeps the buffer alive while the view is held
+	const char *data;
+	int len;
+	REPLY() : data(NULL), len(0) {}
+	void copy(const char *s, int n) {	//for replies not in the buffer
+		block.reset((char *)malloc(n+1), free);
+		if ( block ) { memcpy(block.get(), s, n); block.get()[n] = 0; }
+		data = block.get();
+		len = block ? n : 0;
+	}
+};
 class Fl_Term : public Fl_Widget {
 	char c_attr;		//current character attribute(color)
 	char save_attr;		//saved character attribute, used with save_x/save_y
 	char *buff;			//buffer for characters, one byte per char
+	std::shared_ptr<char> buff_block;//owns buff, shared with REPLY views
+	int view_end;		//end of REPLY views given out on buff_block
 	char *attr;			//buffer for attributes, one byte per char
 	int buff_size; 		//current buffer size, doubles at more_chars()
 	int *line;			//buffer for starting position of each line
@@ -37,6 +69,8 @@ class Fl_Term : public Fl_Widget {
 	int save_x;			//save_x/save_y also used to save and restore cursor
 	int save_y;			//previous cursor_y when switch to alternate screen
 	int screen_y;		//the line at top of screen
+	int erased_lines;	//lines dropped by next_line() at 64k lines
+	long erased_chars;	//chars dropped by next_line() at 64k lines
 	int roll_top;
 	int roll_bot;		//the range of lines that will scroll in alterscreen
 	int sel_left;
@@ -47,6 +81,7 @@ class Fl_Term : public Fl_Widget {
 	int font_face;		//current font face
 	std::atomic<bool> redraw_pending;
 	std::mutex append_mtx;
+	std::condition_variable prompt_cv;	//notified when sPrompt is found
 
 	bool bEscape;		//escape sequence processing mode
 	int ESC_idx;		//current index for ESC_code
@@ -71,6 +106,30 @@ class Fl_Term : public Fl_Widget {
 	char sPrompt[32];	//wait for sPrompt before next command when scripting
 	int iPrompt;		//length of sPrompt
 	bool bPrompt;		//if sPrompt was found after the last append
+	bool bTimedOut;		//waitfor_prompt() timed out before sPrompt was found
+	bool bAbort;		//abort_wait() stops waitfor_prompt() and expect()
+	bool bReplyError;	//an error pattern was received after mark_prompt()
+	std::vector<std::string> patterns;	//extra prompt, pager, confirm strings
+	std::vector<char> pattern_acts;		//PROMPT_DONE/SPACE/YES per pattern
+	std::vector<int> ac_next;	//Aho-Corasick automaton, 256 entries per state
+	std::vector<char> ac_act;	//action of the pattern ending at each state
+	int ac_state;		//automaton state, carried across append() calls
+	int match_x;		//cursor_x right after the last pattern match
+	bool bMarks;		//host sends OSC 133 marks, used instead of sPrompt
+	char mark_last;		//last OSC 133 mark, 'C' while a command runs
+	int mark_x;			//cursor_x at OSC 133 B, where command input starts
+	char match_act;		//action of the last pattern match
+	std::string sPatterns;	//pattern list returned by !Pattern
+	std::vector<CMD_BLOCK> blocks;	//commands still in the buffer, and replies
+	std::map<std::string, std::vector<int>> block_idx;//blocks of each command
+	long blocks_dropped;	//blocks trimmed or cleared, id of blocks[0]
+	int pipe_sent;		//blocks sent, blocks[pipe_done..pipe_sent) in flight
+	int pipe_done;		//blocks completed by counting prompts
+	int pipe_first;		//first block of the current pipelined run, -1 if none
+	int pipe_window;	//current window, halved on errors, grows to iWindow
+	int pipe_clean;		//replies without error since the last window change
+	bool pipe_lost;		//an echo didn't follow a prompt, window stays 1
+	int iWindow;		//max commands in flight, 1 for no pipelining
 
 	int iTimeOut;		//time out in seconds while waiting for sPrompt
 	int recv0;			//cursor_x at the start of last command
@@ -78,35 +137,65 @@ class Fl_Term : public Fl_Widget {
 	int xmlTagIsOpen;	//used by putxml
 
 	bool bDND;			//if a FL_PASTE is result of drag&drop
-	bool bWait;			//waitfor() function is waiting for string in buffer
+	bool bWait;			//expect() is waiting for a regex match in buffer
+	long reply0;		//absolute offset of the last reply, used by !Match
+	std::map<std::string, std::string> vars;//script variables, ${name}
 	bool bEcho;			//if local echo is active
 	bool bScriptRun;
 	bool bScriptPause;
 
 	std::atomic<bool> bGets;//gets() function is waiting for return bing pressed
 	std::atomic<bool> bReturn;//true if return has been pressed during gets()
+	std::atomic<bool> bAsk;	//ask() is active, pass input to host->answer()
+	std::mutex gets_mtx;
+	std::condition_variable gets_cv;	//notified when return is pressed
 	int cursor;			//gets receive buffer index
 	char keys[64];		//gets receive buffer
 	bool bPassword;		//if gets() is wating for password, no echo if yes
 
 	char *LogFileName;
 	FILE *fpLogFile;
+	FILE *fpRecord;		//session recording, chunks from host with timing
+	double record_start;//time the recording was started
+	std::atomic<bool> bReplay;//replay() is running, cleared to stop it
+	bool bHeadless;		//no window, no font, used for replay and batch
+	host_callback *tap_cb;	//gets a copy of host output, for streaming
+	void *tap_data;
+	TERM_METRICS stats;	//bytes and timing, for the /metrics page
 	HOST *host;
 
+	void init();
+
 protected:
 	void draw();
 	void next_line();
+	bool buff_move(int size, int from, int len);
+	void buff_unshare();
+	void buff_write(int from) { if ( from<view_end ) buff_unshare(); }
+	int  view(REPLY *reply, int start, int end);
 	void buff_clear(int offset, int len);
 	void termsize(int cols, int rows);
 	void screen_clear(int m0);
 	void check_cursor_y();
 	void append( const char *buf, int len );
 	void put_xml(const char *buf, int len);
+	int  export_lines(char *out, int size, int *py, int end, int fmt);
+	void build_patterns();
+	void add_block(const char *cmd);
+	void close_blocks();
+	void blocks_trim();
+	void block_done();
+	void echo_check();
+	void semantic_mark(char mark, const char *arg);
+	bool pipeline(const char *cmd);
+	int  expect(const char *alts, int secs, REPLY *reply);
+	int  match(const char *re);
 	const unsigned char *vt100_Escape(const unsigned char *buf, int cnt);
 	const unsigned char *telnet_options(const unsigned char *buf, int cnt);
 
 public:
 	Fl_Term(int X,int Y,int W,int H,const char* L=0);
+	Fl_Term(int cols, int rows);	//headless terminal, nothing drawn
 	~Fl_Term();
 	void clear();
 	int  handle(int e);
@@ -123,27 +212,55 @@ public:
 	char *logg() { return LogFileName; }
 	void logg(const char *fn);
 	void save(const char *fn);
+	void exporter(char *fn);
+	bool recording() { return fpRecord!=NULL; }
+	void record(const char *fn);
+	int  replay(const char *fn, double speed, long *bytes, double *secs);
+	void replayer(char *params);
 	void srch(const char *word);
 
-	int connect(HOST *newhost, const char **preply);
+	int connect(HOST *newhost, REPLY *reply);
 	bool live() { return host->live(); }
+	HOST *dup_host() { return host->dup(); }
+	const TERM_METRICS &metrics() { return stats; }
+	void tap(host_callback *cb, void *data) { tap_data=data; tap_cb=cb; }
+	int  lines_since(long *pos, REPLY *reply);
 	void puts(const char *buf, int len);
 	void write(const char *buf, int len);
 	char *gets(const char *prompt, int echo);
+	void ask(const char *prompt, int echo);
 	void disconn();
+	void hangup() { host->hangup(); }
 	void disp(const char *buf) { append(buf, strlen(buf)); }
 	void send(const char *buf) { write(buf, strlen(buf)); }
 
 	void learn_prompt();
 	int  mark_prompt();
-	int  waitfor_prompt();
-	int command(const char *cmd, const char **preply);
+	int  waitfor_prompt(REPLY *reply=NULL);
+	void abort_wait(bool abort);
+	int  recv_reply(REPLY *reply);
+	int command(const char *cmd, REPLY *reply);
+	void mark_command(const char *cmd);
+	int  history(const char *arg, REPLY *reply);
+	bool jump_block(int n);
+	void jump_prompt(int dir);
 
 
 	void copier(char *files);
 	void scripter(char *cmds);
 	void run_script(const char *script);
+	bool run(SCRIPT *script, script_exec *exec=NULL, void *data=NULL);
+	bool exec(const char *cmd);
+	bool exec_wait() { return pipeline(NULL); }	//replies of pipelined ones
+	bool pipelining() { return iWindow>1; }
+	long last_block();
+	int  block_reply(long id, REPLY *reply, bool *error, bool *timed_out);
+	void expand_vars(const char *cmd, std::string &out);
+	void setvar(const char *name, const char *value) { vars[name] = value; }
 	bool script_running() { return bScriptRun; }
+	bool script_paused() { return bScriptPause; }
+	bool timed_out() { return bTimedOut; }
+	bool reply_error() { return bReplyError; }
 	bool pause_script();
 	void quit_script();
 };
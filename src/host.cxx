@@ -30,14 +30,33 @@
 	#include <signal.h>
 	#include <errno.h>
 #endif
+#ifdef __linux__
+	#include <sys/epoll.h>
+#endif
 #include "host.h"
+#include <mutex>
+#include <map>
+#include <vector>
 using namespace std;
 
+static std::mutex connect_mtx;
+static void reader_run(HOST *host)
+{//read() hands over to the reactor and detaches quickly, wait for the swap
+	connect_mtx.lock();
+	connect_mtx.unlock();
+	host->read();
+}
 void HOST::connect()
+{//not while borrowers still use what's left of the last connection
+	if ( !live() ) start();
+}
+void HOST::start()
 {
-	if ( !reader.joinable() ) {
-		std::thread new_reader(&HOST::read, this);
+	if ( !running() ) {
+		connect_mtx.lock();
+		std::thread new_reader(reader_run, this);
 		reader.swap(new_reader);
+		connect_mtx.unlock();
 	}
 }
 void HOST::print(const char *fmt, ...)
@@ -50,6 +69,219 @@ void HOST::print(const char *fmt, ...)
 	term_puts(buff, len);
 	term_puts("\033[37m",5);
 }
+/**********************************reactor******************************/
+const int REACTOR_THREADS = 4;
+struct WATCH {
+	HOST *host;
+	unsigned int id;	//new for every watch(), events of a closed fd dropped
+	bool in;			//readable() wants to read fd
+	bool out;			//readable() is waiting for fd to be writable
+};
+struct REACTOR {
+	std::mutex mtx;		//to protect fds
+	std::map<int, WATCH> fds;
+	unsigned int ids;
+	int hosts;			//hosts given to this thread, the next goes to the least
+#ifdef __linux__
+	int ep;
+#else
+	int wake_s;			//select() is waken up to pick up changes of fds
+#endif
+};
+static REACTOR reactors[REACTOR_THREADS];
+static std::mutex reactor_mtx;	//to protect hosts and loop of each host
+static bool reactor_started = false;
+
+int wake_socket()
+{//udp socket connected to itself on loopback, non blocking
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	if ( s==-1 ) return -1;
+	struct sockaddr_in addr;
+	socklen_t size = sizeof(addr);
+	memset(&addr, 0, size);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if ( bind(s, (struct sockaddr *)&addr, size)==-1
+		|| getsockname(s, (struct sockaddr *)&addr, &size)==-1
+		|| ::connect(s, (struct sockaddr *)&addr, size)==-1 ) {
+		closesocket(s);
+		return -1;
+	}
+#ifdef WIN32
+	u_long on = 1;
+	ioctlsocket(s, FIONBIO, &on);
+#else
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL)|O_NONBLOCK);
+#endif
+	return s;
+}
+static void reactor_events(REACTOR *r, int fd, const WATCH &w)
+{
+#ifdef __linux__
+	struct epoll_event ev;
+	ev.events = (w.in ? EPOLLIN : 0) | (w.out ? EPOLLOUT : 0);
+	ev.data.u64 = ((uint64_t)w.id<<32) | (unsigned int)fd;
+	epoll_ctl(r->ep, EPOLL_CTL_MOD, fd, &ev);
+#else
+	send(r->wake_s, "w", 1, 0);
+#endif
+}
+void reactor_ready(int loop, HOST *host, int fd)
+{
+	REACTOR *r = reactors+loop;
+	int rc = host->readable(fd);
+	r->mtx.lock();
+	if ( rc<0 ) {
+		for ( auto it=r->fds.begin(); it!=r->fds.end(); ) {
+			if ( it->second.host==host ) {
+#ifdef __linux__
+				epoll_ctl(r->ep, EPOLL_CTL_DEL, it->first, NULL);
+#endif
+				it = r->fds.erase(it);
+			}
+			else
+				it++;
+		}
+	}
+	r->mtx.unlock();
+	if ( rc<0 ) {
+		host->detached();
+		reactor_mtx.lock();
+		r->hosts--;
+		host->loop = -1;
+		reactor_mtx.unlock();
+		host->watched = false;	//last touch, host may be deleted after this
+	}
+}
+static HOST *reactor_find(REACTOR *r, int fd, unsigned int id)
+{
+	HOST *host = NULL;
+	r->mtx.lock();
+	auto it = r->fds.find(fd);
+	if ( it!=r->fds.end() && it->second.id==id ) host = it->second.host;
+	r->mtx.unlock();
+	return host;
+}
+static void reactor_run(int loop)
+{
+	REACTOR *r = reactors+loop;
+#ifdef __linux__
+	struct epoll_event evs[64];
+	while ( true ) {
+		int n = epoll_wait(r->ep, evs, 64, -1);
+		for ( int i=0; i<n; i++ ) {
+			int fd = (int)(evs[i].data.u64 & 0xffffffff);
+			HOST *host = reactor_find(r, fd, evs[i].data.u64>>32);
+			if ( host!=NULL ) reactor_ready(loop, host, fd);
+		}
+	}
+#else
+	std::vector<std::pair<int, unsigned int>> ready;
+	while ( true ) {
+		fd_set rfds, wfds;
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_SET(r->wake_s, &rfds);
+		int maxfd = r->wake_s;
+		r->mtx.lock();
+		for ( auto &it : r->fds ) {
+			if ( it.second.in ) FD_SET(it.first, &rfds);
+			if ( it.second.out ) FD_SET(it.first, &wfds);
+			if ( it.first>maxfd ) maxfd = it.first;
+		}
+		r->mtx.unlock();
+		if ( select(maxfd+1, &rfds, &wfds, NULL, NULL)<=0 ) continue;
+		if ( FD_ISSET(r->wake_s, &rfds) ) {
+			char buf[64];
+			while ( recv(r->wake_s, buf, sizeof(buf), 0)>0 );
+		}
+		ready.clear();
+		r->mtx.lock();
+		for ( auto &it : r->fds )
+			if ( FD_ISSET(it.first, &rfds) || FD_ISSET(it.first, &wfds) )
+				ready.push_back(std::make_pair(it.first, it.second.id));
+		r->mtx.unlock();
+		for ( auto &it : ready ) {
+			HOST *host = reactor_find(r, it.first, it.second);
+			if ( host!=NULL ) reactor_ready(loop, host, it.first);
+		}
+	}
+#endif
+}
+void HOST::watch(int fd, int fd2)
+{//both fds added at once, so neither can detach the host before the other
+	reactor_mtx.lock();
+	if ( !reactor_started ) {
+		for ( int i=0; i<REACTOR_THREADS; i++ ) {
+			REACTOR *r = reactors+i;
+			r->ids = r->hosts = 0;
+#ifdef __linux__
+			r->ep = epoll_create1(EPOLL_CLOEXEC);
+#else
+			r->wake_s = wake_socket();
+#endif
+			std::thread reactor_thread(reactor_run, i);
+			reactor_thread.detach();
+		}
+		reactor_started = true;
+	}
+	if ( loop==-1 ) {
+		loop = 0;
+		for ( int i=1; i<REACTOR_THREADS; i++ )
+			if ( reactors[i].hosts<reactors[loop].hosts ) loop = i;
+		reactors[loop].hosts++;
+	}
+	REACTOR *r = reactors+loop;
+	reactor_mtx.unlock();
+
+	watched = true;
+	r->mtx.lock();
+	int fds[2] = { fd, fd2 };
+	for ( int i=0; i<2; i++ ) if ( fds[i]!=-1 ) {
+		WATCH &w = r->fds[fds[i]];
+		w.host = this;
+		w.id = ++r->ids;
+		w.in = true;
+		w.out = false;
+#ifdef __linux__
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u64 = ((uint64_t)w.id<<32) | (unsigned int)fds[i];
+		epoll_ctl(r->ep, EPOLL_CTL_ADD, fds[i], &ev);
+#endif
+	}
+	r->mtx.unlock();
+#ifndef __linux__
+	send(r->wake_s, "w", 1, 0);
+#endif
+}
+void HOST::events(int fd, bool in, bool out)
+{//called by readable() to change what it waits for on one of its fds
+	if ( loop==-1 ) return;
+	REACTOR *r = reactors+loop;
+	r->mtx.lock();
+	auto it = r->fds.find(fd);
+	if ( it!=r->fds.end() && (it->second.in!=in || it->second.out!=out) ) {
+		it->second.in = in;
+		it->second.out = out;
+		reactor_events(r, fd, it->second);
+	}
+	r->mtx.unlock();
+}
+void HOST::unwatch(int fd)
+{//called before closing fd, by readable() or detached()
+	if ( loop==-1 ) return;
+	REACTOR *r = reactors+loop;
+	r->mtx.lock();
+	if ( r->fds.erase(fd)>0 ) {
+#ifdef __linux__
+		epoll_ctl(r->ep, EPOLL_CTL_DEL, fd, NULL);
+#else
+		send(r->wake_s, "w", 1, 0);
+#endif
+	}
+	r->mtx.unlock();
+}
 /**********************************comHost******************************/
 comHost::comHost(const char *address)
 {
@@ -379,20 +611,30 @@ int tcpHost::read()
 {
 	status( HOST_CONNECTING );
 	if ( tcp()==0 ) {
-		int cch;
-		char buf[4096];
 		status( HOST_CONNECTED );
 		term_puts("Connected", 0);
-		while ( (cch=recv(sock, buf, 4096, 0))>0 ) term_puts(buf, cch);
-		closesocket(sock);
-		sock = -1;
-		term_puts("Disconnected", -1);
+		watch(sock);
 	}
-
-	status(HOST_IDLE);
+	else
+		status(HOST_IDLE);
 	reader.detach();
 	return 0;
 }
+int tcpHost::readable(int fd)
+{
+	char buf[4096];
+	int cch = recv(sock, buf, 4096, 0);
+	if ( cch<=0 ) return -1;
+	term_puts(buf, cch);
+	return 0;
+}
+void tcpHost::detached()
+{
+	closesocket(sock);
+	sock = -1;
+	term_puts("Disconnected", -1);
+	status(HOST_IDLE);
+}
 int tcpHost::write(const char *buf, int len)
 {
 	int total=0;
@@ -407,6 +649,10 @@ void tcpHost::disconn()
 {
 	if ( sock!=-1 ) shutdown(sock, 1);	//SD_SEND=1 on Win32, SHUT_WR=1 on posix
 }
+void tcpHost::hangup()
+{
+	if ( sock!=-1 ) shutdown(sock, 2);	//SD_BOTH/SHUT_RDWR=2
+}
 pipeHost::pipeHost(const char *name):HOST()
 {
 	strncpy(cmdline, name, 255);
@@ -565,23 +811,32 @@ int pipeHost::read()
 		close(pty_slave);
 		term_puts("shell started", 0);
 		status( HOST_CONNECTED );
-		char buf[4096];
-		int len;
-		while ( (len=::read(pty_master, buf, 4096))>0 ) {
-			term_puts(buf, len);
-		}
-		status( HOST_IDLE );
-		term_puts("", -1);
+		watch(pty_master);
+		reader.detach();
+		return 0;
 	}
 pty_close:
 	close(pty_master);
 	reader.detach();
 	return 0;
 }
+int pipeHost::readable(int fd)
+{
+	char buf[4096];
+	int len = ::read(pty_master, buf, 4096);
+	if ( len<=0 ) return -1;
+	term_puts(buf, len);
+	return 0;
+}
+void pipeHost::detached()
+{
+	status( HOST_IDLE );
+	term_puts("", -1);
+	close(pty_master);
+}
 int pipeHost::write( const char *buf, int len )
 {
-	int cch = ::write(pty_master, buf, len);
-	if ( cch<0 ) close(pty_master);
+	::write(pty_master, buf, len);	//a dead shell is seen by readable()
 	return 0;
 }
 void pipeHost::send_size(int sx, int sy)
@@ -595,4 +850,8 @@ void pipeHost::disconn()
 {
 	kill( shell_pid, SIGTERM );	
 }
+void pipeHost::hangup()
+{
+	kill( shell_pid, SIGKILL );
+}
 #endif
@@ -6,6 +6,10 @@
 //	  host implementation for terminal simulator
 //    to be used with the Fl_Term widget.
 //
+//	  connect() runs read() in a thread of its own for connecting and login,
+//    once connected the descriptors are watched by a few reactor threads
+//    shared by all hosts, which call readable() when there is data
+//
 // Copyright 2017-2020 by Yongchao Fan.
 //
 // This library is free software distributed under GNU GPL 3.0,
@@ -34,6 +38,7 @@
 #endif
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 #include <thread>
 
 #ifndef _HOST_H_
@@ -44,6 +49,8 @@ enum {  HOST_NULL=0, HOST_PIPE, HOST_COM, HOST_TCP,
 enum {  HOST_IDLE=0, HOST_CONNECTING, HOST_AUTHENTICATING, HOST_CONNECTED };
 typedef void ( host_callback )(void *, const char *, int);
 typedef char *(host_callback1)(void *, const char *, bool);
+typedef void  (host_callback2)(void *, const char *, bool);
+int wake_socket();		//loopback udp socket, send to it to wake up select()
 
 class HOST {
 protected:
@@ -51,15 +58,29 @@ protected:
 	void *host_data_;
 	host_callback *host_cb;
 	host_callback1 *host_cb1;
+	host_callback2 *host_cb2;
 	std::thread reader;
+	std::atomic<bool> watched;	//descriptors are with the reactor
+	int loop;					//reactor thread watching them, -1 if none
+	std::atomic<int> busy;		//borrowers using this host, kept live till 0
+
+	void start();					//connect() even when busy
+	void watch(int fd, int fd2=-1);	//hand over to the reactor from read()
+	void unwatch(int fd);
+	void events(int fd, bool in, bool out);	//readable/writable wanted on fd
+	friend void reactor_ready(int loop, HOST *host, int fd);
 
 public:
 	HOST()
 	{
 		host_cb = NULL;
 		host_cb1 = NULL;
+		host_cb2 = NULL;
 		host_data_ = NULL;
 		state = HOST_IDLE;
+		watched = false;
+		loop = -1;
+		busy = 0;
 	}
 	virtual ~HOST(){}
 	virtual	void connect();
@@ -68,14 +89,22 @@ public:
 	virtual	int read()			{ return 0; }
 	virtual	int write(const char *buf, int len){ return 0; }
 	virtual	void disconn(){}
+	virtual void hangup(){ disconn(); }	//no goodbye, reads fail right away
 	virtual void send_size(int sx, int sy){}
 	virtual void send_file(char *src, char *dst){}
 	virtual void command(const char *cmd){}
+	virtual void answer(const char *line){}	//reply to term_ask()
+	virtual HOST *dup(){ return NULL; }		//another shell on this connection
+	virtual int readable(int fd){ return -1; }//reactor has data on fd,
+											//or room for output, -1 to detach
+	virtual void detached(){}				//after readable() returned -1
 
-	void callback(host_callback *cb, host_callback1 *cb1, void *data)
+	void callback(host_callback *cb, host_callback1 *cb1,
+					host_callback2 *cb2, void *data)
 	{
 		host_cb = cb;
 		host_cb1 = cb1;
+		host_cb2 = cb2;
 		host_data_ = data;
 	}
 	void term_puts(const char *buf, int len)
@@ -86,7 +115,12 @@ public:
 	{
 		return host_cb1(host_data_, prompt, echo);
 	}
-	int live() { return reader.joinable(); }
+	void term_ask(const char *prompt, int echo)	//returns without waiting,
+	{											//answer() called with input
+		host_cb2(host_data_, prompt, echo);
+	}
+	int running() { return reader.joinable() || watched; }
+	int live() { return running() || busy>0; }
 	int status() { return state; }
 	void status(int s) { state = s; }
 	void print(const char *fmt, ...);
@@ -149,6 +183,11 @@ public:
 	virtual int write(const char *buf, int len);
 	virtual void disconn();
 	virtual void send_size(int sx, int sy);
+#ifndef WIN32
+	virtual void hangup();
+	virtual int readable(int fd);
+	virtual void detached();
+#endif
 };
 
 class tcpHost : public HOST {
@@ -168,5 +207,8 @@ public:
 	virtual	int read();
 	virtual int write(const char *buf, int len);
 	virtual void disconn();
+	virtual void hangup();
+	virtual int readable(int fd);
+	virtual void detached();
 };
 #endif//_HOST_H_
\ No newline at end of file
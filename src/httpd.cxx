@@ -0,0 +1,1387 @@
+//
+// "$Id: httpd.cxx 13562 2026-10-19 16:40:12 $"
+//
+// httpd -- scripting interface at http://127.0.0.1:8080
+//
+//	one thread runs an event loop for all clients with select(), requests
+//    on a connection are answered in order with HTTP/1.1 keep-alive, and
+//    commands are queued to a worker thread of each tab, so a slow command
+//    only holds up the clients of its own tab, host output of a tab can be
+//    streamed to many subscribers, each chunk is copied once and shared,
+//    small files are cached in memory and large ones sent with sendfile()
+//
+// Copyright 2017-2026 by Yongchao Fan.
+//
+// This library is free software distributed under GNU GPL 3.0,
+// see the license at:
+//
+//     https://github.com/yongchaofan/tinyTerm2/blob/master/LICENSE
+//
+// Please report all bugs and problems on the following page:
+//
+//     https://github.com/yongchaofan/tinyTerm2/issues/new
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+#include "Fl_Term.h"
+#include "metrics.h"
+#include <FL/filename.H>
+#include <FL/Fl_Tabs.H>
+#ifndef WIN32
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/un.h>
+#endif
+#ifdef __linux__
+#include <signal.h>
+#include <sys/sendfile.h>
+#endif
+#ifdef WIN32
+#define strncasecmp _strnicmp
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//defined in tiny2.cxx
+extern Fl_Tabs *pTabs;
+extern Fl_Term *pTerm;
+extern int httport;
+int term_command(Fl_Term *t, const char *cmd, REPLY *reply);
+
+enum { JOB_QUEUED=0, JOB_RUNNING, JOB_DONE, JOB_CANCELED };
+const char *job_states[] = { "queued", "running", "done", "canceled" };
+struct HTTP_JOB {			//a command for a tab worker, answered when done
+	int conn;				//id of the connection waiting for the reply,
+							//-1 for a job polled by /jobs/<id>
+	Fl_Term *term;
+	std::string cmd;
+	REPLY reply;
+	int len;
+	int index;				//position in a batch, -1 for a single command
+	const char *status;		//"ok", "error", "timeout" or "disconnected"
+	double secs;			//time the command took
+	int id;					//job id, for polled jobs
+	std::string tab;		//tab label when submitted
+	std::atomic<int> state;	//JOB_QUEUED etc., set to done by the worker
+	std::atomic<bool> cancel;
+};
+struct TAB_WORKER {			//runs the commands of one tab, one at a time
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::list<HTTP_JOB *> jobs;
+	HTTP_JOB *running;		//job being run, to abort its wait on cancel
+};
+struct TAB_STREAM {			//host output of a tab, shared by its subscribers
+	std::mutex mtx;
+	std::string pending;	//raw output from the tap, not yet sent
+	std::atomic<int> subs;	//tap does nothing if there is no subscriber
+	std::atomic<int> raw_subs;
+	int line_subs;
+	long line_pos;			//absolute offset of lines sent to subscribers
+};
+enum { STREAM_NONE=0, STREAM_RAW, STREAM_LINES, STREAM_EVENTS };
+struct HTTP_OUT {			//a response or chunk, header, file or view, tail
+	std::string head;
+	REPLY body;
+	const char *tail;
+	size_t sent;			//bytes of head, body and tail sent
+	FILE *fp;				//large file sent after head, closed when done
+	long long fpos, fsize;	//files over 2GB where long is 32 bits
+	std::string fbuf;		//piece of file being sent, without sendfile()
+	size_t foff;
+	HTTP_OUT() : tail(""), sent(0), fp(NULL), fpos(0), fsize(0), foff(0) {}
+};
+struct FILE_CACHE {			//a file served recently
+	time_t checked;			//stat() again when a second has passed
+	time_t mtime;
+	long long size;
+	REPLY data;				//content of a small file, shared by responses
+};
+static std::map<std::string, FILE_CACHE> files;	//used by httpd thread only
+const long FILE_SMALL = 256*1024;	//files cached in memory up to this size
+struct HTTP_CONN {
+	int s;
+	std::string in;			//received, not parsed yet
+	std::list<HTTP_OUT> out;//responses in the order of requests
+	size_t queued;			//bytes in out, slow subscribers are dropped
+	bool busy;				//a command is running, later requests wait
+	bool close;				//close when out is all sent
+	time_t last;			//last activity, idle connections are closed
+	Fl_Term *stream;		//tab streamed to this connection, or NULL
+	int mode;				//STREAM_RAW etc.
+	int batch;				//batch commands not answered yet
+	double t0;				//time the current request was received
+	bool ctl;				//framed requests from the unix socket, not http
+};
+static std::map<Fl_Term *, TAB_WORKER *> workers;	//used by httpd thread only
+static std::map<Fl_Term *, TAB_STREAM *> streams;	//used by httpd thread only
+static std::mutex done_mtx;
+static std::list<HTTP_JOB *> done_jobs;	//finished by workers, to be answered
+static std::map<int, HTTP_JOB *> polled_jobs;	//used by httpd thread only
+static int next_job = 1;
+const size_t JOB_QUEUE = 64;	//polled jobs waiting per tab
+const size_t JOB_KEEP = 256;	//finished jobs kept for polling
+static int wake_s = -1;		//loopback udp socket to wake up select()
+static std::atomic<bool> wake_pending(false);	//one wake up is enough
+static std::atomic<bool> http_running(false);	//till httpd_exit()
+static int http_s0 = -1;	//tcp on 127.0.0.1, -1 if no port was free
+static int ctl_s0 = -1;		//unix socket for local scripts, not on Windows
+static char ctl_path[108];
+enum { CTL_OK=0, CTL_ERROR, CTL_TIMEOUT, CTL_DISCONNECTED, CTL_NOT_FOUND,
+		CTL_FORBIDDEN, CTL_CANCELED };
+const size_t STREAM_MAX = 4*1024*1024;	//bytes a subscriber may fall behind
+const size_t BODY_MAX = 4*1024*1024;	//largest request body accepted
+
+static bool would_block()
+{
+#ifdef WIN32
+	return WSAGetLastError()==WSAEWOULDBLOCK;
+#else
+	return errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR;
+#endif
+}
+static void nonblock(int s)
+{
+#ifdef WIN32
+	u_long on = 1;
+	ioctlsocket(s, FIONBIO, &on);
+#else
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL)|O_NONBLOCK);
+#endif
+#ifdef __APPLE__
+	int set = 1;			//prevent SIGPIPE to cause app exit
+	setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(int));
+#endif
+}
+static void http_wake()
+{
+	if ( !wake_pending.exchange(true) ) send(wake_s, "w", 1, 0);
+}
+static void http_worker(Fl_Term *t, TAB_WORKER *w)
+{
+	for ( ;; ) {
+		std::unique_lock<std::mutex> lck(w->mtx);
+		w->cv.wait(lck, [w]{ return !w->jobs.empty(); });
+		HTTP_JOB *job = w->jobs.front();
+		w->jobs.pop_front();
+		w->running = job;
+		job->state = JOB_RUNNING;
+		t->abort_wait(false);	//under mtx, so a cancel can't slip in before
+		lck.unlock();
+
+		auto start = std::chrono::steady_clock::now();
+		bool local = job->cmd[0]=='!';
+		if ( job->index>=0 && !local && !t->live() )
+			job->status = "disconnected";
+		else {
+			job->len = term_command(t, job->cmd.c_str(), &job->reply);
+			if ( !local && t->timed_out() ) job->status = "timeout";
+			else if ( !local && t->reply_error() ) job->status = "error";
+		}
+		job->secs = std::chrono::duration<double>(
+						std::chrono::steady_clock::now()-start).count();
+		lck.lock();
+		w->running = NULL;
+		if ( job->cancel ) t->abort_wait(false);//scripts on the tab wait again
+		lck.unlock();
+		if ( job->cancel ) job->status = "canceled";
+		if ( job->conn==-1 ) {	//polled, nothing to answer
+			if ( job->reply.data!=NULL ) {	//kept for polling, copied
+				REPLY view = job->reply;	//not to pin a scroll back block
+				job->reply.copy(view.data, job->len);
+			}
+			job->state = job->cancel ? JOB_CANCELED : JOB_DONE;
+			continue;
+		}
+		done_mtx.lock();
+		done_jobs.push_back(job);
+		done_mtx.unlock();
+		http_wake();
+	}
+}
+static TAB_WORKER *tab_worker(Fl_Term *t)
+{
+	TAB_WORKER *w = workers[t];
+	if ( w==NULL ) {			//tabs are never deleted, nor are workers
+		w = workers[t] = new TAB_WORKER;
+		w->running = NULL;
+		std::thread workerThread(http_worker, t, w);
+		workerThread.detach();
+	}
+	return w;
+}
+static HTTP_JOB *http_dispatch(int id, Fl_Term *t, const char *cmd,
+														int index=-1)
+{
+	TAB_WORKER *w = tab_worker(t);
+	HTTP_JOB *job = new HTTP_JOB;
+	job->conn = id;
+	job->term = t;
+	job->cmd = cmd;
+	job->len = 0;
+	job->index = index;
+	job->status = "ok";
+	job->secs = 0;
+	job->id = 0;
+	job->state = JOB_QUEUED;
+	job->cancel = false;
+	std::lock_guard<std::mutex> lck(w->mtx);
+	w->jobs.push_back(job);
+	w->cv.notify_one();
+	return job;
+}
+static int tab_count()
+{
+	return pTabs==NULL ? 1 : pTabs->children();
+}
+static Fl_Term *tab_child(int i)
+{
+	return pTabs==NULL ? pTerm : (Fl_Term *)pTabs->child(i);
+}
+static Fl_Term *tab_find(const char *id)
+{//tab by number starting from 1, or by label like !Tab
+	Fl_Term *t = NULL;
+	Fl::lock();
+	int n = tab_count();
+	if ( isdigit(*id) ) {
+		int i = atoi(id);
+		if ( i>=1 && i<=n ) t = tab_child(i-1);
+	}
+	else for ( int i=0; i<n && t==NULL; i++ )
+		if ( strncmp(tab_child(i)->label(), id, strlen(id))==0 )
+			t = tab_child(i);
+	Fl::unlock();
+	return t;
+}
+static void tab_label(Fl_Term *t, char *label)
+{//label without the close button, label is 64 bytes
+	strncpy(label, t->label(), 63);
+	label[63] = 0;
+	char *p = strstr(label, " @-31+");
+	if ( p!=NULL ) *p = 0;
+}
+static int tab_list(REPLY *reply)
+{//one line per tab: number, label, state, commands queued, active or not
+	std::string list;
+	Fl::lock();
+	for ( int i=0; i<tab_count(); i++ ) {
+		Fl_Term *t = tab_child(i);
+		char label[64];
+		tab_label(t, label);
+		int queued = 0;
+		auto it = workers.find(t);
+		if ( it!=workers.end() ) {
+			std::lock_guard<std::mutex> lck(it->second->mtx);
+			queued = it->second->jobs.size();
+		}
+		char line[256];
+		snprintf(line, 256, "%d\t%s\t%s\t%d%s\n", i+1, label,
+				t->live() ? "connected" : "disconnected", queued,
+				t==pTerm ? "\tactive" : "");
+		list += line;
+	}
+	Fl::unlock();
+	reply->copy(list.c_str(), list.size());
+	return reply->len;
+}
+static int metrics_page(REPLY *reply)
+{//Prometheus text format, samples of a metric are kept together
+	const char *names[] = { "connected", "bytes_in_total", "bytes_out_total",
+							"parse_seconds_total" };
+	const char *types[] = { "gauge", "counter", "counter", "counter" };
+	std::string tabs[4], waits, out;
+	char line[256];
+	Fl::lock();
+	for ( int i=0; i<tab_count(); i++ ) {
+		Fl_Term *t = tab_child(i);
+		char label[64], labels[160];
+		tab_label(t, label);
+		for ( char *p=label; *p; p++ ) if ( *p=='"' || *p=='\\' ) *p = '_';
+		snprintf(labels, 160, "tab=\"%d\",label=\"%s\"", i+1, label);
+		const TERM_METRICS &m = t->metrics();
+		unsigned long long v[4] = { t->live() ? 1ull : 0ull, m.bytes_in.load(),
+								m.bytes_out.load(), m.parse_ns.load() };
+		for ( int j=0; j<4; j++ ) {
+			if ( j<3 )
+				snprintf(line, 256, "flterm_tab_%s{%s} %llu\n", names[j],
+														labels, v[j]);
+			else
+				snprintf(line, 256, "flterm_tab_%s{%s} %.6f\n", names[j],
+														labels, v[j]/1e9);
+			tabs[j] += line;
+		}
+		m.prompt_wait.print(waits, "flterm_tab_prompt_wait_seconds", labels);
+	}
+	Fl::unlock();
+	for ( int j=0; j<4; j++ ) {
+		snprintf(line, 256, "# TYPE flterm_tab_%s %s\n", names[j], types[j]);
+		out += line + tabs[j];
+	}
+	out += "# TYPE flterm_tab_prompt_wait_seconds histogram\n" + waits;
+
+	APP_METRICS &m = app_metrics();
+	const char *xfers[] = { "proto=\"scp\",dir=\"get\"", "proto=\"scp\",dir=\"put\"",
+						"proto=\"sftp\",dir=\"get\"", "proto=\"sftp\",dir=\"put\"" };
+	out += "# TYPE flterm_transfer_bytes_total counter\n";
+	for ( int k=0; k<XFER_KINDS; k++ ) {
+		snprintf(line, 256, "flterm_transfer_bytes_total{%s} %llu\n", xfers[k],
+												m.xfer_bytes[k].load());
+		out += line;
+	}
+	out += "# TYPE flterm_transfer_files_total counter\n";
+	for ( int k=0; k<XFER_KINDS; k++ ) {
+		snprintf(line, 256, "flterm_transfer_files_total{%s} %llu\n", xfers[k],
+												m.xfer_files[k].load());
+		out += line;
+	}
+	out += "# TYPE flterm_transfer_seconds_total counter\n";
+	for ( int k=0; k<XFER_KINDS; k++ ) {
+		snprintf(line, 256, "flterm_transfer_seconds_total{%s} %.3f\n",
+									xfers[k], m.xfer_ms[k].load()/1e3);
+		out += line;
+	}
+	snprintf(line, 256, "# TYPE flterm_tunnels_open gauge\n"
+			"flterm_tunnels_open %ld\n"
+			"# TYPE flterm_tunnels_total counter\n"
+			"flterm_tunnels_total %llu\n", m.tunnels_open.load(),
+			m.tunnels_total.load());
+	out += line;
+	snprintf(line, 256, "# TYPE flterm_tunnel_bytes_total counter\n"
+			"flterm_tunnel_bytes_total{dir=\"in\"} %llu\n"
+			"flterm_tunnel_bytes_total{dir=\"out\"} %llu\n",
+			m.tunnel_bytes_in.load(), m.tunnel_bytes_out.load());
+	out += line;
+	snprintf(line, 256, "# TYPE flterm_http_requests_total counter\n"
+			"flterm_http_requests_total %llu\n", m.http_requests.load());
+	out += line;
+	out += "# TYPE flterm_http_request_duration_seconds histogram\n";
+	m.http_latency.print(out, "flterm_http_request_duration_seconds", "");
+	reply->copy(out.c_str(), out.size());
+	return reply->len;
+}
+static void http_timed(HTTP_CONN &c)
+{//a response header is queued, the request is answered
+	APP_METRICS &m = app_metrics();
+	metric_add(m.http_requests, 1);
+	m.http_latency.observe(metric_clock()-c.t0);
+}
+static void http_respond(HTTP_CONN &c, const char *status, const char *type,
+					const char *extra, REPLY &body, long long len, FILE *fp=NULL)
+{//body is a view of len bytes, or the file fp of len bytes
+	char head[512];
+	if ( body.data==NULL && fp==NULL ) len = 0;	//e.g. !Window, a count only
+	snprintf(head, 512, "HTTP/1.1 %s\r\nServer: FLTerm\r\n"
+			"Access-Control-Allow-Origin: *\r\nContent-Type: %s\r\n"
+			"Content-Length: %lld\r\n%s%s\r\n", status, type, len, extra,
+			c.close ? "Connection: close\r\n" : "");
+	HTTP_OUT o;
+	o.head = head;
+	if ( fp==NULL ) {
+		o.body = body;
+		o.body.len = (int)len;
+	}
+	else {
+		o.fp = fp;
+		o.fsize = len;
+	}
+	c.out.push_back(o);
+	c.queued += o.head.size()+o.body.len;
+	http_timed(c);
+}
+static void stream_tap(void *data, const char *buf, int len)
+{//called by the reader thread of the tab with every chunk of host output
+	TAB_STREAM *ts = (TAB_STREAM *)data;
+	if ( ts->subs==0 ) return;
+	if ( ts->raw_subs>0 ) {
+		std::lock_guard<std::mutex> lck(ts->mtx);
+		if ( ts->pending.size()>STREAM_MAX )	//httpd is stuck, drop oldest
+			ts->pending.erase(0, ts->pending.size()/2);
+		ts->pending.append(buf, len);
+	}
+	http_wake();
+}
+static void chunked_head(HTTP_CONN &c, const char *type)
+{
+	char head[512];
+	snprintf(head, 512, "HTTP/1.1 200 OK\r\nServer: FLTerm\r\n"
+			"Access-Control-Allow-Origin: *\r\nContent-Type: %s\r\n"
+			"Cache-Control: no-cache\r\nTransfer-Encoding: chunked\r\n\r\n",
+			type);
+	HTTP_OUT o;
+	o.head = head;
+	c.out.push_back(o);
+	c.queued += o.head.size();
+	http_timed(c);
+}
+static void stream_add(HTTP_CONN &c, Fl_Term *t, int mode)
+{
+	TAB_STREAM *ts = streams[t];
+	if ( ts==NULL ) {			//tabs are never deleted, the tap stays
+		ts = streams[t] = new TAB_STREAM;
+		ts->subs = ts->raw_subs = ts->line_subs = 0;
+		ts->line_pos = -1;
+		t->tap(stream_tap, ts);
+	}
+	if ( mode==STREAM_RAW ) {
+		std::lock_guard<std::mutex> lck(ts->mtx);
+		if ( ts->raw_subs++==0 ) ts->pending.clear();
+	}
+	else if ( ts->line_subs++==0 )
+		ts->line_pos = -1;		//start from the current line
+	ts->subs++;
+	c.stream = t;
+	c.mode = mode;
+	chunked_head(c, mode==STREAM_EVENTS ? "text/event-stream" : "text/plain");
+}
+static void stream_remove(HTTP_CONN &c)
+{
+	if ( c.stream==NULL ) return;
+	TAB_STREAM *ts = streams[c.stream];
+	if ( c.mode==STREAM_RAW ) ts->raw_subs--; else ts->line_subs--;
+	ts->subs--;
+	c.stream = NULL;
+}
+static void stream_chunk(HTTP_CONN &c, REPLY &body)
+{
+	char head[16];
+	snprintf(head, 16, "%x\r\n", body.len);
+	HTTP_OUT o;
+	o.head = head;
+	o.body = body;
+	o.tail = "\r\n";
+	c.out.push_back(o);
+	c.queued += o.head.size()+body.len+2;
+}
+static void stream_send(std::map<int, HTTP_CONN> &conns)
+{//new output of every streamed tab is taken once, then queued by reference
+ //to each subscriber, subscribers too far behind are dropped
+	for ( auto &it : streams ) {
+		TAB_STREAM *ts = it.second;
+		if ( ts->subs==0 ) continue;
+		REPLY raw, lines, events;
+		if ( ts->raw_subs>0 ) {
+			std::lock_guard<std::mutex> lck(ts->mtx);
+			if ( !ts->pending.empty() ) {
+				raw.copy(ts->pending.data(), ts->pending.size());
+				ts->pending.clear();
+			}
+		}
+		if ( ts->line_subs>0 && it.first->lines_since(&ts->line_pos, &lines)>0 ) {
+			std::string ev;		//one event per line
+			const char *p = lines.data, *zz = lines.data+lines.len;
+			while ( p<zz ) {
+				const char *q = (const char *)memchr(p, 0x0a, zz-p);
+				if ( q==NULL ) q = zz;
+				ev += "data: ";
+				ev.append(p, (q>p && q[-1]==0x0d) ? q-p-1 : q-p);
+				ev += "\n\n";
+				p = q+1;
+			}
+			events.copy(ev.data(), ev.size());
+		}
+		for ( auto &ci : conns ) {
+			HTTP_CONN &c = ci.second;
+			if ( c.stream!=it.first ) continue;
+			REPLY &body = c.mode==STREAM_RAW ? raw :
+						 (c.mode==STREAM_LINES ? lines : events);
+			if ( body.len==0 ) continue;
+			if ( c.queued>STREAM_MAX ) {	//slow consumer, drop it
+				c.out.clear();
+				c.queued = 0;
+				c.close = true;
+			}
+			else
+				stream_chunk(c, body);
+		}
+	}
+}
+static void http_error(HTTP_CONN &c, const char *status)
+{
+	REPLY body;
+	body.copy(status, strlen(status));
+	http_respond(c, status, "text/plain", "", body, body.len);
+}
+
+const char *RFC1123FMT="%a, %d %b %Y %H:%M:%S GMT";
+const char *exts[]={".txt",
+					".htm", ".html",
+					".js",
+					".jpg", ".jpeg",
+					".png",
+					".css"
+					};
+const char *mime[]={"text/plain",
+					"text/html", "text/html",
+					"text/javascript",
+					"image/jpeg", "image/jpeg",
+					"image/png",
+					"text/css"
+					};
+static bool file_allowed(const char *file)
+{//only under the working directory: not absolute, no drive, no ".."
+	if ( *file=='/' || *file=='\\' || strchr(file, ':')!=NULL ) return false;
+	for ( const char *p=file; *p; ) {
+		size_t n = strcspn(p, "/\\");
+		if ( n==2 && p[0]=='.' && p[1]=='.' ) return false;
+		p += n;
+		if ( *p ) p++;
+	}
+	return true;
+}
+static void http_file(HTTP_CONN &c, const char *file, const std::string &inm,
+												const std::string &ims)
+{//small files are answered from cache, stat() at most once a second,
+ //304 if the client has the same ETag or Last-Modified
+	if ( !file_allowed(file) ) {
+		http_error(c, "403 Forbidden");
+		return;
+	}
+	time_t now = time(NULL);
+	if ( files.size()>128 && files.find(file)==files.end() ) files.clear();
+	FILE_CACHE &f = files[file];
+	if ( f.checked!=now ) {
+		struct stat sb;
+		if ( stat(file, &sb)==-1 || (sb.st_mode&S_IFMT)!=S_IFREG ) {
+			files.erase(file);
+			http_error(c, "404 Not Found");
+			return;
+		}
+		if ( sb.st_mtime!=f.mtime || sb.st_size!=f.size ) {
+			f.mtime = sb.st_mtime;
+			f.size = sb.st_size;
+			f.data = REPLY();
+		}
+		f.checked = now;
+	}
+
+	const char *filext=strrchr(file, '.');
+	int i=0;
+	if ( filext!=NULL ) {
+		for ( int j=0; j<8; j++ )
+			if ( strcmp(filext, exts[j])==0 ) i=j;
+	}
+	char etag[64], timebuf[64], extra[256];
+	snprintf(etag, 64, "\"%lx-%llx\"", (long)f.mtime, f.size);
+	strftime(timebuf, sizeof(timebuf), RFC1123FMT, gmtime(&f.mtime));
+	snprintf(extra, 256, "ETag: %s\r\nLast-Modified: %s\r\n"
+					"Cache-Control: no-cache\r\n", etag, timebuf);
+	REPLY body;
+	if ( inm.empty() ? ims==timebuf : inm==etag ) {
+		http_respond(c, "304 Not Modified", mime[i], extra, body, 0);
+		return;
+	}
+
+	FILE *fp = fopen(file, "rb");
+	if ( fp==NULL ) {
+		files.erase(file);
+		http_error(c, "404 Not Found");
+		return;
+	}
+	if ( f.size>FILE_SMALL ) {
+		http_respond(c, "200 OK", mime[i], extra, body, f.size, fp);
+		return;
+	}
+	if ( f.data.data==NULL ) {
+		std::string data;
+		char buf[4096];
+		int len;
+		while ( (len=fread(buf, 1, 4096, fp))>0 ) data.append(buf, len);
+		f.data.copy(data.c_str(), data.size());
+	}
+	fclose(fp);
+	http_respond(c, "200 OK", mime[i], extra, f.data, f.data.len);
+}
+static int file_send(int s, HTTP_OUT &o)
+{//send the file of o from o.fpos, returns -1 if the socket is full or broken,
+ //0 when all of the file is sent, 1 if the file got shorter than fsize and
+ //the connection has to be closed, as Content-Length can't be met
+	while ( o.fpos<o.fsize ) {
+#ifdef __linux__
+		off_t off = o.fpos;
+		ssize_t n = sendfile(s, fileno(o.fp), &off, o.fsize-o.fpos);
+		if ( n<0 ) return -1;
+		if ( n==0 ) break;			//file got shorter
+		o.fpos = off;
+#else
+		if ( o.fbuf.empty() ) {
+			char buf[65536];
+			int n = fread(buf, 1, 65536, o.fp);
+			if ( n<=0 ) break;
+			o.fbuf.assign(buf, n);
+			o.foff = 0;
+		}
+		int n = send(s, o.fbuf.data()+o.foff, o.fbuf.size()-o.foff,
+															MSG_NOSIGNAL);
+		if ( n<0 ) return -1;
+		o.foff += n;
+		if ( o.foff==o.fbuf.size() ) {
+			o.fpos += o.fbuf.size();
+			o.fbuf.clear();
+		}
+#endif
+	}
+	fclose(o.fp);
+	o.fp = NULL;
+	return o.fpos<o.fsize ? 1 : 0;
+}
+static const char *json_skip(const char *p)
+{
+	while ( *p==' ' || *p=='\t' || *p=='\r' || *p=='\n' ) p++;
+	return p;
+}
+static const char *json_string(const char *p, std::string &s)
+{//p at the opening quote, returns the char after the closing quote or NULL
+	s.clear();
+	for ( p++; *p!='"'; p++ ) {
+		if ( *p==0 ) return NULL;
+		if ( *p!='\\' ) {
+			s += *p;
+			continue;
+		}
+		switch ( *++p ) {
+		case 0:   return NULL;
+		case 'n': s += '\n'; break;
+		case 'r': s += '\r'; break;
+		case 't': s += '\t'; break;
+		case 'b': s += '\b'; break;
+		case 'f': s += '\f'; break;
+		case 'u': {
+				unsigned int u = 0;
+				for ( int i=1; i<=4; i++ ) {
+					if ( !isxdigit((unsigned char)p[i]) ) return NULL;
+					u = u*16+(isdigit(p[i]) ? p[i]-'0' : (p[i]|0x20)-'a'+10);
+				}
+				p += 4;
+				if ( u<0x80 )			//to utf-8
+					s += (char)u;
+				else if ( u<0x800 ) {
+					s += (char)(0xc0|(u>>6));
+					s += (char)(0x80|(u&0x3f));
+				}
+				else {
+					s += (char)(0xe0|(u>>12));
+					s += (char)(0x80|((u>>6)&0x3f));
+					s += (char)(0x80|(u&0x3f));
+				}
+			}
+			break;
+		default:  s += *p;			//quote, backslash and slash
+		}
+	}
+	return p+1;
+}
+static const char *json_item(const char *p, std::string &tab, std::string &cmd)
+{//"cmd" or {"tab":"rtr1","cmd":"show version"}, returns the char after it
+	if ( *p=='"' ) return json_string(p, cmd);
+	if ( *p!='{' ) return NULL;
+	p = json_skip(p+1);
+	while ( *p!='}' ) {
+		std::string key, val;
+		if ( *p!='"' || (p=json_string(p, key))==NULL ) return NULL;
+		p = json_skip(p);
+		if ( *p++!=':' ) return NULL;
+		p = json_skip(p);
+		if ( *p=='"' ) {
+			if ( (p=json_string(p, val))==NULL ) return NULL;
+		}
+		else if ( isdigit(*p) ) {	//tab by number
+			while ( isdigit(*p) ) val += *p++;
+		}
+		else
+			return NULL;
+		if ( key=="cmd" ) cmd = val;
+		if ( key=="tab" ) tab = val;
+		p = json_skip(p);
+		if ( *p==',' )
+			p = json_skip(p+1);
+		else if ( *p!='}' )
+			return NULL;
+	}
+	return p+1;
+}
+static const char *batch_parse(const char *p, Fl_Term *t,
+						std::vector<std::pair<Fl_Term *, std::string>> &cmds)
+{//a JSON array, or one command per line as plain text or JSON,
+ //returns the error status if the batch is refused
+	std::vector<std::pair<std::string, std::string>> items;
+	p = json_skip(p);
+	if ( *p=='[' ) {
+		p = json_skip(p+1);
+		while ( *p!=']' ) {
+			std::string tab, cmd;
+			if ( (p=json_item(p, tab, cmd))==NULL ) return "400 Bad Request";
+			items.push_back(std::make_pair(tab, cmd));
+			p = json_skip(p);
+			if ( *p==',' )
+				p = json_skip(p+1);
+			else if ( *p!=']' )
+				return "400 Bad Request";
+		}
+	}
+	else while ( *p ) {
+		const char *q = p+strcspn(p, "\n");
+		std::string tab, cmd;
+		if ( *p=='"' || *p=='{' ) {
+			const char *r = json_item(p, tab, cmd);
+			if ( r==NULL || json_skip(r)<q ) return "400 Bad Request";
+		}
+		else
+			cmd.assign(p, (q>p && q[-1]=='\r') ? q-p-1 : q-p);
+		items.push_back(std::make_pair(tab, cmd));
+		p = json_skip(q);
+	}
+	for ( auto &item : items ) {
+		Fl_Term *term = item.first.empty() ? t : tab_find(item.first.c_str());
+		if ( term==NULL ) return "404 Not Found";
+		if ( strncmp(item.second.c_str(), "!Tab", 4)==0 )
+			return "403 Forbidden";	//tabs of a batch are fixed when parsed
+		cmds.push_back(std::make_pair(term, item.second));
+	}
+	return NULL;
+}
+static void json_escape(std::string &out, const char *s, int len)
+{
+	char u[8];
+	out += '"';
+	for ( int i=0; i<len; i++ ) {
+		unsigned char ch = s[i];
+		if ( ch=='"' || ch=='\\' ) {
+			out += '\\';
+			out += ch;
+		}
+		else if ( ch=='\n' ) out += "\\n";
+		else if ( ch=='\r' ) out += "\\r";
+		else if ( ch=='\t' ) out += "\\t";
+		else if ( ch<0x20 ) {
+			snprintf(u, 8, "\\u%04x", ch);
+			out += u;
+		}
+		else
+			out += ch;
+	}
+	out += '"';
+}
+static void batch_result(HTTP_CONN &c, HTTP_JOB *job)
+{//one JSON line per command, sent as a chunk when the command is done
+	char head[128];
+	snprintf(head, 128, "{\"index\":%d,\"status\":\"%s\",\"ms\":%ld,\"cmd\":",
+				job->index, job->status, (long)(job->secs*1000));
+	std::string line = head;
+	json_escape(line, job->cmd.c_str(), job->cmd.size());
+	line += ",\"reply\":";
+	json_escape(line, job->reply.data, job->reply.data==NULL ? 0 : job->len);
+	line += "}\n";
+	REPLY body;
+	body.copy(line.c_str(), line.size());
+	stream_chunk(c, body);
+}
+static void http_batch(int id, HTTP_CONN &c, Fl_Term *t, const std::string &body)
+{//commands are queued to the workers of their tabs at once, tabs run in
+ //parallel, results are streamed in the order they finish
+	std::vector<std::pair<Fl_Term *, std::string>> cmds;
+	const char *err = batch_parse(body.c_str(), t, cmds);
+	if ( err!=NULL ) {
+		http_error(c, err);
+		return;
+	}
+	chunked_head(c, "application/x-ndjson");
+	if ( cmds.empty() ) {
+		REPLY none;
+		stream_chunk(c, none);		//last chunk
+		return;
+	}
+	c.busy = true;
+	c.batch = cmds.size();
+	for ( size_t i=0; i<cmds.size(); i++ )
+		http_dispatch(id, cmds[i].first, cmds[i].second.c_str(), i);
+}
+static void job_json(std::string &out, HTTP_JOB *job, bool reply)
+{
+	char head[128];
+	int state = job->state;
+	snprintf(head, 128, "{\"id\":%d,\"state\":\"%s\",\"tab\":", job->id,
+														job_states[state]);
+	out += head;
+	json_escape(out, job->tab.c_str(), job->tab.size());
+	out += ",\"cmd\":";
+	json_escape(out, job->cmd.c_str(), job->cmd.size());
+	if ( state==JOB_DONE || state==JOB_CANCELED ) {
+		snprintf(head, 128, ",\"status\":\"%s\",\"ms\":%ld", job->status,
+												(long)(job->secs*1000));
+		out += head;
+		if ( reply ) {
+			out += ",\"reply\":";
+			json_escape(out, job->reply.data,
+							job->reply.data==NULL ? 0 : job->len);
+		}
+	}
+	out += "}";
+}
+static void job_trim()
+{//drop the oldest finished jobs beyond JOB_KEEP
+	for ( auto it=polled_jobs.begin(); polled_jobs.size()>JOB_KEEP
+										&& it!=polled_jobs.end(); ) {
+		int state = it->second->state;
+		if ( state==JOB_DONE || state==JOB_CANCELED ) {
+			delete it->second;
+			it = polled_jobs.erase(it);
+		}
+		else
+			++it;
+	}
+}
+static void job_submit(HTTP_CONN &c, Fl_Term *t, const std::string &body)
+{//the posted body is the command, answered at once with the job id
+	std::string cmd = body.substr(0, body.find_first_of("\r\n"));
+	if ( strncmp(cmd.c_str(), "!Tab", 4)==0 ) {
+		http_error(c, "403 Forbidden");
+		return;
+	}
+	TAB_WORKER *w = tab_worker(t);
+	size_t queued;
+	w->mtx.lock();
+	queued = w->jobs.size();
+	w->mtx.unlock();
+	if ( queued>=JOB_QUEUE ) {
+		http_error(c, "429 Too Many Requests");
+		return;
+	}
+	HTTP_JOB *job = http_dispatch(-1, t, cmd.c_str());
+	job->id = next_job++;			//not used by the worker
+	char label[64];
+	Fl::lock();
+	tab_label(t, label);
+	Fl::unlock();
+	job->tab = label;
+	polled_jobs[job->id] = job;
+	job_trim();
+
+	std::string out;
+	job_json(out, job, false);
+	out += "\n";
+	REPLY answer;
+	answer.copy(out.c_str(), out.size());
+	char extra[64];
+	snprintf(extra, 64, "Location: /jobs/%d\r\n", job->id);
+	http_respond(c, "202 Accepted", "application/json", extra, answer,
+															answer.len);
+}
+static void job_cancel(HTTP_JOB *job)
+{//a queued job is dropped, a running one gets ^C and its wait aborted
+	TAB_WORKER *w = workers[job->term];
+	std::lock_guard<std::mutex> lck(w->mtx);
+	for ( auto it=w->jobs.begin(); it!=w->jobs.end(); ++it ) {
+		if ( *it==job ) {
+			w->jobs.erase(it);
+			job->status = "canceled";
+			job->state = JOB_CANCELED;
+			return;
+		}
+	}
+	if ( w->running==job && !job->cancel ) {
+		job->cancel = true;
+		if ( job->cmd[0]!='!' ) job->term->send("\003");
+		job->term->abort_wait(true);
+	}
+}
+static void http_jobs(HTTP_CONN &c, const char *path, bool del)
+{//jobs lists all, jobs/<id> polls one with its reply, DELETE cancels it
+	std::string out;
+	if ( *path==0 ) {
+		if ( del ) {
+			http_error(c, "405 Method Not Allowed");
+			return;
+		}
+		out = "[";
+		for ( auto &it : polled_jobs ) {
+			if ( out.size()>1 ) out += ",\n";
+			job_json(out, it.second, false);
+		}
+		out += "]\n";
+	}
+	else {
+		auto it = polled_jobs.find(atoi(path+1));
+		if ( it==polled_jobs.end() ) {
+			http_error(c, "404 Not Found");
+			return;
+		}
+		if ( del ) job_cancel(it->second);
+		job_json(out, it->second, true);
+		out += "\n";
+	}
+	REPLY body;
+	body.copy(out.c_str(), out.size());
+	http_respond(c, "200 OK", "application/json", "Cache-Control: no-cache\r\n",
+														body, body.len);
+}
+static void http_route(int id, HTTP_CONN &c, Fl_Term *t, const char *path,
+								bool tab_route, const std::string *body)
+{//?cmd, stream, stream?lines or events of a tab, batch or jobs if posted
+	if ( strcmp(path, "batch")==0 || strcmp(path, "jobs")==0 ) {
+		if ( body==NULL )
+			http_error(c, "405 Method Not Allowed");
+		else if ( *path=='b' )
+			http_batch(id, c, t, *body);
+		else
+			job_submit(c, t, *body);
+	}
+	else if ( body!=NULL )
+		http_error(c, "405 Method Not Allowed");
+	else if ( *path=='?' ) {
+		if ( tab_route && strncmp(path+1, "!Tab", 4)==0 )
+			http_error(c, "403 Forbidden");	//would switch others' tab
+		else {
+			c.busy = true;
+			http_dispatch(id, t, path+1);
+		}
+	}
+	else if ( strcmp(path, "stream")==0 )
+		stream_add(c, t, STREAM_RAW);
+	else if ( strcmp(path, "stream?lines")==0 )
+		stream_add(c, t, STREAM_LINES);
+	else if ( strcmp(path, "events")==0 )
+		stream_add(c, t, STREAM_EVENTS);
+	else
+		http_error(c, "404 Not Found");
+}
+static std::string header_value(const char *h)
+{
+	while ( *h==' ' ) h++;
+	size_t n = strcspn(h, "\r\n");
+	return std::string(h, n);
+}
+static bool http_request(int id, HTTP_CONN &c)
+{//answer the requests in c.in till one has to wait for a tab worker,
+ //returns false if the connection should be closed right away
+	if ( c.stream!=NULL ) c.in.clear();		//nothing more after a stream
+	while ( !c.busy && !c.close && c.stream==NULL ) {
+		size_t end = c.in.find("\r\n\r\n"), skip = 4;
+		size_t end2 = c.in.find("\n\n");
+		if ( end2<end ) { end = end2; skip = 2; }
+		if ( end==std::string::npos ) return c.in.size()<65536;
+
+		std::string req = c.in.substr(0, end);
+		char method[16], target[4096], version[16];
+		*version = 0;
+		if ( sscanf(req.c_str(), "%15s %4095s %15s", method, target, version)<2 )
+			return false;
+		bool keep = strcmp(version, "HTTP/1.1")==0;
+		size_t clen = 0;
+		std::string inm, ims;		//If-None-Match, If-Modified-Since
+		for ( size_t p=req.find('\n'); p!=std::string::npos;
+											p=req.find('\n', p+1) ) {
+			const char *h = req.c_str()+p+1;
+			if ( strncasecmp(h, "Content-Length:", 15)==0 )
+				clen = strtoul(h+15, NULL, 10);
+			if ( strncasecmp(h, "If-None-Match:", 14)==0 )
+				inm = header_value(h+14);
+			if ( strncasecmp(h, "If-Modified-Since:", 18)==0 )
+				ims = header_value(h+18);
+			if ( strncasecmp(h, "Connection:", 11)==0 ) {
+				h += 11;
+				while ( *h==' ' ) h++;
+				if ( strncasecmp(h, "close", 5)==0 ) keep = false;
+				if ( strncasecmp(h, "keep-alive", 10)==0 ) keep = true;
+			}
+		}
+		if ( clen>BODY_MAX ) {
+			c.close = true;
+			http_error(c, "413 Payload Too Large");
+			break;
+		}
+		if ( c.in.size()<end+skip+clen ) return true;	//body not all here
+		std::string body = c.in.substr(end+skip, clen);
+		c.in.erase(0, end+skip+clen);
+		c.t0 = metric_clock();
+		if ( !keep ) c.close = true;
+
+		bool post = strcmp(method, "POST")==0;
+		bool del = strcmp(method, "DELETE")==0;
+		if ( (!post && !del && strcmp(method, "GET")!=0) || *target!='/' ) {
+			c.close = true;
+			http_error(c, "405 Method Not Allowed");
+			break;
+		}
+		char *cmd = target+1;
+		for ( char *p=cmd; *p; p++ ) if ( *p=='+' ) *p=' ';
+		fl_decode_uri(cmd);
+		bool jobs = strncmp(cmd, "jobs", 4)==0 && (cmd[4]==0 || cmd[4]=='/');
+		if ( del && !jobs )
+			http_error(c, "405 Method Not Allowed");
+		else if ( jobs ) {
+			if ( post && cmd[4]==0 )
+				job_submit(c, pTerm, body);	//active tab
+			else if ( post )
+				http_error(c, "405 Method Not Allowed");
+			else
+				http_jobs(c, cmd+4, del);
+		}
+		else if ( strcmp(cmd, "tabs")==0 ) {
+			REPLY list;
+			tab_list(&list);
+			http_respond(c, "200 OK", "text/plain",
+						"Cache-Control: no-cache\r\n", list, list.len);
+		}
+		else if ( strcmp(cmd, "metrics")==0 ) {
+			REPLY page;
+			metrics_page(&page);
+			http_respond(c, "200 OK", "text/plain; version=0.0.4",
+						"Cache-Control: no-cache\r\n", page, page.len);
+		}
+		else if ( strncmp(cmd, "tab/", 4)==0 ) {	//tab/<id>/path
+			char *q = cmd+4+strcspn(cmd+4, "/?");
+			std::string tab(cmd+4, q-cmd-4);
+			Fl_Term *t = tab_find(tab.c_str());
+			if ( t==NULL )
+				http_error(c, "404 Not Found");
+			else
+				http_route(id, c, t, *q=='/' ? q+1 : q, true,
+												post ? &body : NULL);
+		}
+		else if ( *cmd=='?' || strncmp(cmd, "stream", 6)==0
+					|| strcmp(cmd, "events")==0 || strcmp(cmd, "batch")==0 )
+			http_route(id, c, pTerm, cmd, false, post ? &body : NULL);
+		else if ( post )
+			http_error(c, "405 Method Not Allowed");
+		else					//get file
+			http_file(c, cmd, inm, ims);
+	}
+	return true;
+}
+static void ctl_respond(HTTP_CONN &c, int status, REPLY &reply, int len)
+{//4 byte length and 4 byte status in network order, then the reply
+	if ( reply.data==NULL ) len = 0;
+	unsigned char head[8];
+	for ( int i=0; i<4; i++ ) {
+		head[i] = (unsigned int)len>>(24-i*8);
+		head[4+i] = (unsigned int)status>>(24-i*8);
+	}
+	HTTP_OUT o;
+	o.head.assign((char *)head, 8);
+	o.body = reply;
+	o.body.len = len;
+	c.out.push_back(o);
+	c.queued += 8+len;
+	http_timed(c);
+}
+static int ctl_status(const char *status)
+{
+	const char *names[] = { "ok", "error", "timeout", "disconnected" };
+	for ( int i=0; i<4; i++ ) if ( strcmp(status, names[i])==0 ) return i;
+	return CTL_CANCELED;
+}
+static bool ctl_request(int id, HTTP_CONN &c)
+{//4 byte length in network order, then "tab\0cmd" or just "cmd" for the
+ //active tab, answered in order like pipelined http requests
+	while ( !c.busy && !c.close ) {
+		if ( c.in.size()<4 ) return true;
+		const unsigned char *p = (const unsigned char *)c.in.data();
+		size_t len = ((size_t)p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+		if ( len>BODY_MAX ) return false;
+		if ( c.in.size()<4+len ) return true;
+		std::string req = c.in.substr(4, len);
+		c.in.erase(0, 4+len);
+		c.t0 = metric_clock();
+
+		size_t z = req.find('\0');
+		std::string tab = z==std::string::npos ? "" : req.substr(0, z);
+		std::string cmd = z==std::string::npos ? req : req.substr(z+1);
+		Fl_Term *t = tab.empty() ? pTerm : tab_find(tab.c_str());
+		REPLY none;
+		if ( t==NULL )
+			ctl_respond(c, CTL_NOT_FOUND, none, 0);
+		else if ( !tab.empty() && strncmp(cmd.c_str(), "!Tab", 4)==0 )
+			ctl_respond(c, CTL_FORBIDDEN, none, 0);
+		else {
+			c.busy = true;
+			http_dispatch(id, t, cmd.c_str());
+		}
+	}
+	return true;
+}
+static bool conn_request(int id, HTTP_CONN &c)
+{
+	return c.ctl ? ctl_request(id, c) : http_request(id, c);
+}
+static void http_close(HTTP_CONN &c)
+{
+	stream_remove(c);
+	for ( HTTP_OUT &o : c.out ) if ( o.fp!=NULL ) fclose(o.fp);
+	closesocket(c.s);
+}
+static bool http_flush(HTTP_CONN &c)
+{//send what the socket takes, returns false if the connection is broken
+	while ( !c.out.empty() ) {
+		HTTP_OUT &o = c.out.front();
+		size_t h = o.head.size(), b = h+o.body.len;
+		size_t total = b+strlen(o.tail);
+		while ( o.sent<total || o.fp!=NULL ) {
+			if ( o.sent==h && o.fp!=NULL ) {	//file goes after the head
+				int rc = file_send(c.s, o);
+				if ( rc==-1 ) return would_block();
+				if ( rc==1 ) return false;
+				continue;
+			}
+			const char *p = o.head.data()+o.sent;
+			size_t n = h-o.sent;
+			if ( o.sent>=b ) {
+				p = o.tail+(o.sent-b);
+				n = total-o.sent;
+			}
+			else if ( o.sent>=h ) {
+				p = o.body.data+(o.sent-h);
+				n = b-o.sent;
+			}
+			int len = send(c.s, p, n>65536 ? 65536 : n, MSG_NOSIGNAL);
+			if ( len<0 ) return would_block();
+			o.sent += len;
+		}
+		c.queued -= total;
+		c.out.pop_front();		//releases the reply view
+	}
+	return true;
+}
+static void httpd(int s0)
+{//s0 or ctl_s0 may be -1, the other one is listening
+	std::map<int, HTTP_CONN> conns;	//by connection id, as sockets are reused
+	int next_id = 0;
+	char buf[16384];
+	while ( http_running ) {
+		fd_set rfds, wfds;
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_SET(wake_s, &rfds);
+		int maxfd = wake_s;
+		if ( s0!=-1 ) {
+			FD_SET(s0, &rfds);
+			if ( s0>maxfd ) maxfd = s0;
+		}
+		if ( ctl_s0!=-1 ) {
+			FD_SET(ctl_s0, &rfds);
+			if ( ctl_s0>maxfd ) maxfd = ctl_s0;
+		}
+		for ( auto &it : conns ) {
+			HTTP_CONN &c = it.second;
+			FD_SET(c.s, &rfds);
+			if ( !c.out.empty() ) FD_SET(c.s, &wfds);
+			if ( c.s>maxfd ) maxfd = c.s;
+		}
+		struct timeval tv = { 1, 0 };
+		if ( select(maxfd+1, &rfds, &wfds, NULL, &tv)<0 ) {
+			if ( would_block() ) continue;
+			break;
+		}
+		time_t now = time(NULL);
+		if ( FD_ISSET(wake_s, &rfds) ) {
+			while ( recv(wake_s, buf, sizeof(buf), 0)>0 );
+			wake_pending = false;
+		}
+
+		std::list<HTTP_JOB *> jobs;
+		done_mtx.lock();
+		jobs.swap(done_jobs);
+		done_mtx.unlock();
+		for ( HTTP_JOB *job : jobs ) {	//answer and go on with pipelined
+			auto it = conns.find(job->conn);
+			if ( it!=conns.end() ) {
+				HTTP_CONN &c = it->second;
+				c.last = now;
+				if ( job->index>=0 ) {
+					batch_result(c, job);
+					if ( --c.batch==0 ) {
+						REPLY none;
+						stream_chunk(c, none);	//last chunk
+						c.busy = false;
+					}
+				}
+				else {
+					if ( c.ctl )
+						ctl_respond(c, ctl_status(job->status), job->reply,
+																job->len);
+					else
+						http_respond(c, "200 OK", "text/plain",
+						"Cache-Control: no-cache\r\n", job->reply, job->len);
+					c.busy = false;
+				}
+				if ( !c.busy && !conn_request(it->first, c) ) c.close = true;
+			}
+			delete job;
+		}
+		stream_send(conns);
+
+		for ( int l=0; l<2; l++ ) {		//http, then the unix socket
+			int ls = l==0 ? s0 : ctl_s0;
+			if ( ls==-1 || !FD_ISSET(ls, &rfds) ) continue;
+			int s1;
+			while ( (s1=accept(ls, NULL, NULL))!=-1 ) {
+				if ( conns.size()+2>=FD_SETSIZE
+#ifndef WIN32
+					|| s1>=FD_SETSIZE
+#endif
+					) {
+					closesocket(s1);		//no room in fd_set
+					continue;
+				}
+				nonblock(s1);
+				HTTP_CONN &c = conns[next_id++];
+				c.s = s1;
+				c.busy = c.close = false;
+				c.last = now;
+				c.queued = 0;
+				c.stream = NULL;
+				c.mode = STREAM_NONE;
+				c.batch = 0;
+				c.t0 = metric_clock();
+				c.ctl = l==1;
+			}
+		}
+		for ( auto it=conns.begin(); it!=conns.end(); ) {
+			HTTP_CONN &c = it->second;
+			bool ok = true;
+			if ( FD_ISSET(c.s, &rfds) ) {
+				int len = recv(c.s, buf, sizeof(buf), 0);
+				if ( len>0 ) {
+					c.in.append(buf, len);
+					c.last = now;
+					ok = conn_request(it->first, c);
+				}
+				else
+					ok = len<0 && would_block();
+			}
+			if ( ok && !c.out.empty() ) ok = http_flush(c);
+			if ( !ok || (!c.busy && c.out.empty() && (c.close
+				|| (c.stream==NULL && !c.ctl && now-c.last>60))) ) {
+				http_close(c);
+				it = conns.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+	for ( auto &it : conns ) http_close(it.second);
+	if ( s0!=-1 ) closesocket(s0);
+	if ( ctl_s0!=-1 ) closesocket(ctl_s0);
+}
+static void ctl_init()
+{//~/.tinyTerm/tinyTerm.sock, or tinyTerm1.sock etc. if another instance has
+ //it, in a directory made 0700 and bound with umask 077, for the user only
+#ifndef WIN32
+	const char *home = getenv("HOME");
+	if ( home==NULL ) return;
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if ( snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/.tinyTerm",
+									home)>=(int)sizeof(addr.sun_path) ) return;
+	if ( mkdir(addr.sun_path, 0700)==-1 && errno!=EEXIST ) {
+		fprintf(stderr, "couldn't create %s: %s\n", addr.sun_path,
+														strerror(errno));
+		return;
+	}
+	for ( int i=0; i<20; i++ ) {
+		char num[16] = "";
+		if ( i>0 ) snprintf(num, 16, "%d", i);
+		if ( snprintf(addr.sun_path, sizeof(addr.sun_path),
+				"%s/.tinyTerm/tinyTerm%s.sock", home, num)
+										>=(int)sizeof(addr.sun_path) ) return;
+		struct stat sb;
+		if ( lstat(addr.sun_path, &sb)==0 ) {
+			if ( (sb.st_mode&S_IFMT)!=S_IFSOCK ) continue;
+			int s = socket(AF_UNIX, SOCK_STREAM, 0);
+			bool live = s!=-1 &&
+				connect(s, (struct sockaddr *)&addr, sizeof(addr))==0;
+			if ( s!=-1 ) closesocket(s);
+			if ( live ) continue;		//another instance
+			unlink(addr.sun_path);		//left by a crash
+		}
+		int s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ( s==-1 ) {
+			fprintf(stderr, "couldn't open control socket: %s\n",
+														strerror(errno));
+			return;
+		}
+		mode_t mask = umask(077);
+		int rc = bind(s, (struct sockaddr *)&addr, sizeof(addr));
+		umask(mask);
+		if ( rc==-1 || listen(s, SOMAXCONN)==-1 ) {
+			fprintf(stderr, "couldn't listen on %s: %s\n", addr.sun_path,
+														strerror(errno));
+			if ( rc!=-1 ) unlink(addr.sun_path);
+			closesocket(s);
+			return;
+		}
+		nonblock(s);
+		strcpy(ctl_path, addr.sun_path);
+		ctl_s0 = s;
+		return;
+	}
+#endif
+}
+static int http_listen()
+{//first free port from 8080 on 127.0.0.1
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if ( s==-1 ) return -1;
+
+	struct sockaddr_in svraddr;
+	socklen_t addrsize=sizeof(svraddr);
+	memset(&svraddr, 0, addrsize);
+	svraddr.sin_family=AF_INET;
+	svraddr.sin_addr.s_addr=inet_addr("127.0.0.1");
+
+	short port = 8079;
+	while ( ++port<8100 ) {
+		svraddr.sin_port=htons(port);
+		if ( bind(s, (struct sockaddr*)&svraddr, addrsize)!=-1 )
+			break;
+	}
+	if ( port<8100) {
+		if ( listen(s, SOMAXCONN)!=-1){
+			nonblock(s);
+			httport = port;
+			return s;
+		}
+	}
+	closesocket(s);
+	return -1;
+}
+void httpd_init()
+{
+#ifdef WIN32
+    WSADATA wsadata;
+    WSAStartup(MAKEWORD(2,0), &wsadata);
+#endif
+#ifdef __linux__
+	signal(SIGPIPE, SIG_IGN);	//sendfile() has no MSG_NOSIGNAL
+#endif
+	wake_s = wake_socket();
+	if ( wake_s==-1 ) return;
+	http_s0 = http_listen();
+	ctl_init();					//local scripts, with or without a tcp port
+	if ( http_s0==-1 && ctl_s0==-1 ) return;
+	http_running = true;
+	std::thread httpThread(httpd, http_s0);
+	httpThread.detach();
+}
+void httpd_exit()
+{
+	if ( !http_running ) return;
+	http_running = false;
+	http_wake();
+#ifndef WIN32
+	if ( *ctl_path ) unlink(ctl_path);
+#endif
+}
@@ -0,0 +1,118 @@
+//
+// "$Id: metrics.h 3318 2026-10-19 10:12:40 $"
+//
+// METRICS -- counters and histograms for the /metrics page of httpd
+//
+//	plain atomics added to with relaxed order on the hot paths, no locks,
+//    read by httpd when the page is requested, in Prometheus text format
+//
+// Copyright 2017-2026 by Yongchao Fan.
+//
+// This library is free software distributed under GNU GPL 3.0,
+// see the license at:
+//
+//     https://github.com/yongchaofan/tinyTerm2/blob/master/LICENSE
+//
+// Please report all bugs and problems on the following page:
+//
+//     https://github.com/yongchaofan/tinyTerm2/issues/new
+//
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+typedef std::atomic<unsigned long long> COUNTER;
+typedef std::atomic<long> GAUGE;
+
+inline void metric_add(COUNTER &c, unsigned long long n)
+{
+	c.fetch_add(n, std::memory_order_relaxed);
+}
+
+const int HIST_BUCKETS = 12;	//upper bounds in seconds, +Inf after the last
+static const double hist_le[HIST_BUCKETS] = { 0.001, 0.005, 0.01, 0.025,
+								0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+struct HISTOGRAM {
+	COUNTER bucket[HIST_BUCKETS+1];	//not cumulative, summed when printed
+	COUNTER sum_us;
+	HISTOGRAM() {
+		for ( int i=0; i<=HIST_BUCKETS; i++ ) bucket[i] = 0;
+		sum_us = 0;
+	}
+	void observe(double secs) {
+		int i = 0;
+		while ( i<HIST_BUCKETS && secs>hist_le[i] ) i++;
+		metric_add(bucket[i], 1);
+		metric_add(sum_us, (unsigned long long)(secs*1000000));
+	}
+	void print(std::string &out, const char *name, const char *labels) const {
+		char line[256];
+		unsigned long long n = 0;
+		for ( int i=0; i<=HIST_BUCKETS; i++ ) {
+			n += bucket[i].load(std::memory_order_relaxed);
+			char le[16];
+			if ( i<HIST_BUCKETS )
+				snprintf(le, 16, "%g", hist_le[i]);
+			else
+				strcpy(le, "+Inf");
+			snprintf(line, 256, "%s_bucket{%s%sle=\"%s\"} %llu\n", name,
+									labels, *labels ? "," : "", le, n);
+			out += line;
+		}
+		std::string l;
+		if ( *labels ) l = std::string("{")+labels+"}";
+		snprintf(line, 256, "%s_sum%s %.6f\n%s_count%s %llu\n",
+				name, l.c_str(), sum_us.load(std::memory_order_relaxed)/1e6,
+				name, l.c_str(), n);
+		out += line;
+	}
+};
+
+struct TERM_METRICS {		//one per tab, in Fl_Term
+	COUNTER bytes_in;		//from host, all parsed by append()
+	COUNTER bytes_out;		//to host
+	COUNTER parse_ns;		//time spent in append() for host output
+	HISTOGRAM prompt_wait;	//time waitfor_prompt() took
+	TERM_METRICS() { bytes_in = bytes_out = parse_ns = 0; }
+};
+
+enum { XFER_SCP_GET=0, XFER_SCP_PUT, XFER_SFTP_GET, XFER_SFTP_PUT, XFER_KINDS };
+struct APP_METRICS {		//everything not per tab
+	COUNTER xfer_bytes[XFER_KINDS];	//added per block as files are copied
+	COUNTER xfer_files[XFER_KINDS];
+	COUNTER xfer_ms[XFER_KINDS];	//added when a file is done
+	GAUGE tunnels_open;
+	COUNTER tunnels_total;
+	COUNTER tunnel_bytes_in;		//from the ssh channel to the local socket
+	COUNTER tunnel_bytes_out;
+	COUNTER http_requests;
+	HISTOGRAM http_latency;	//request received till response header queued
+	APP_METRICS() {
+		for ( int i=0; i<XFER_KINDS; i++ )
+			xfer_bytes[i] = xfer_files[i] = xfer_ms[i] = 0;
+		tunnels_open = 0;
+		tunnels_total = tunnel_bytes_in = tunnel_bytes_out = 0;
+		http_requests = 0;
+	}
+};
+inline APP_METRICS &app_metrics()
+{
+	static APP_METRICS m;
+	return m;
+}
+inline double metric_clock()	//monotonic time in seconds
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+inline void metric_xfer_done(int kind, double start)
+{
+	APP_METRICS &m = app_metrics();
+	metric_add(m.xfer_files[kind], 1);
+	metric_add(m.xfer_ms[kind], (unsigned long long)((metric_clock()-start)*1000));
+}
+#endif //_METRICS_H_
@@ -0,0 +1,251 @@
+//
+// "$Id: script.cxx 9464 2026-10-19 10:12:40 $"
+//
+// SCRIPT -- script compiler and virtual machine
+//
+//	a script is compiled once to a list of ops, control lines like
+//    !If/!Else/!Loop/!End are resolved to jumps and !Include files are
+//    inlined, so running a 100k line script does no parsing per line
+//
+// Copyright 2017-2026 by Yongchao Fan.
+//
+// This library is free software distributed under GNU GPL 3.0,
+// see the license at:
+//
+//     https://github.com/yongchaofan/tinyTerm2/blob/master/LICENSE
+//
+// Please report all bugs and problems on the following page:
+//
+//     https://github.com/yongchaofan/tinyTerm2/issues/new
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+#include "script.h"
+#include "Fl_Term.h"
+
+int SCRIPT::compile(const char *text)
+{
+	ops.clear();
+	blocks.clear();
+	breaks.clear();
+	*err = 0;
+	char *buf = strdup(text);
+	int rc = parse(buf, 0);
+	free(buf);
+	if ( rc!=-1 && !blocks.empty() ) {
+		OP &op = ops[blocks.back()];
+		snprintf(err, 256, "line %d: !%s without !End", op.line,
+					op.code==OP_LOOP ? "Loop" : "If");
+		rc = -1;
+	}
+	return rc==-1 ? -1 : ops.size();
+}
+int SCRIPT::parse(char *text, int depth)
+{//one op per line, jumps are filled in when the block is closed
+	char *p1 = text, *p0;
+	int line_no = 0;
+	while ( p1!=NULL ) {
+		p0 = p1;
+		p1 = strchr(p0, 0x0a);
+		if ( p1!=NULL ) *p1++ = 0;
+		line_no++;
+		int len = strlen(p0);
+		if ( len>0 && p0[len-1]==0x0d ) p0[len-1] = 0;
+
+		OP op;
+		op.code = OP_CMD;
+		op.line = line_no;
+		op.jump = -1;
+		if ( strncmp(p0, "!Set ", 5)==0 ) {
+			char *v = strchr(p0+5, ' ');
+			op.code = OP_SET;
+			op.name = v==NULL ? std::string(p0+5) : std::string(p0+5, v-p0-5);
+			op.arg = v==NULL ? "" : v+1;
+		}
+		else if ( strncmp(p0, "!If ", 4)==0 ) {
+			op.code = OP_IF;
+			op.arg = p0+4;
+			blocks.push_back(ops.size());
+		}
+		else if ( strcmp(p0, "!Else")==0 ) {
+			if ( blocks.empty() || ops[blocks.back()].code!=OP_IF ) {
+				snprintf(err, 256, "line %d: !Else without !If", line_no);
+				return -1;
+			}
+			op.code = OP_ELSE;
+			ops[blocks.back()].jump = ops.size()+1;
+			blocks.back() = ops.size();
+		}
+		else if ( strncmp(p0, "!Loop", 5)==0 && (p0[5]==0 || p0[5]==' ') ) {
+			op.code = OP_LOOP;			//!Loop without count runs till !Break
+			op.arg = p0[5]==0 ? "" : p0+6;
+			blocks.push_back(ops.size());
+			breaks.push_back(std::vector<int>());
+		}
+		else if ( strcmp(p0, "!Break")==0 ) {
+			if ( breaks.empty() ) {
+				snprintf(err, 256, "line %d: !Break without !Loop", line_no);
+				return -1;
+			}
+			op.code = OP_BREAK;
+			breaks.back().push_back(ops.size());
+		}
+		else if ( strcmp(p0, "!End")==0 ) {
+			if ( blocks.empty() ) {
+				snprintf(err, 256, "line %d: !End without !If or !Loop",
+																	line_no);
+				return -1;
+			}
+			int b = blocks.back();
+			blocks.pop_back();
+			op.code = OP_END;
+			if ( ops[b].code==OP_LOOP ) {
+				op.jump = b;			//back to the loop for the count
+				ops[b].jump = ops.size()+1;
+				for ( int i : breaks.back() ) ops[i].jump = ops.size()+1;
+				breaks.pop_back();
+			}
+			else
+				ops[b].jump = ops.size();
+		}
+		else if ( strncmp(p0, "!Include ", 9)==0 ) {
+			FILE *fp = fopen(p0+9, "rb");
+			if ( fp==NULL || depth>=8 ) {
+				snprintf(err, 256, "line %d: couldn't include %s", line_no,
+																	p0+9);
+				if ( fp!=NULL ) fclose(fp);
+				return -1;
+			}
+			std::string inc;
+			char buf[4096];
+			int n;
+			while ( (n=fread(buf, 1, 4096, fp))>0 ) inc.append(buf, n);
+			fclose(fp);
+			while ( !inc.empty() && (inc.back()==0x0a || inc.back()==0x0d) )
+				inc.pop_back();			//no empty command at end of file
+			if ( parse(&inc[0], depth+1)==-1 ) return -1;
+			continue;
+		}
+		else
+			op.arg = p0;
+		op.vars = op.arg.find("${")!=std::string::npos;
+		ops.push_back(op);
+	}
+	return 0;
+}
+static std::string expand(Fl_Term *term, const OP &op)
+{
+	std::string s;
+	if ( op.vars )
+		term->expand_vars(op.arg.c_str(), s);
+	else
+		s = op.arg;
+	return s;
+}
+static bool number(const std::string &s, long *n)
+{
+	char *end;
+	*n = strtol(s.c_str(), &end, 10);
+	return !s.empty() && *end==0;
+}
+bool SCRIPT::test(Fl_Term *term, const OP &op)
+{//"a == b", "a != b", "a < b", "a > b", or true if "a" is not empty or 0
+	std::string s = expand(term, op);
+	const char *cmps[] = { " == ", " != ", " < ", " > " };
+	for ( int i=0; i<4; i++ ) {
+		size_t pos = s.find(cmps[i]);
+		if ( pos==std::string::npos ) continue;
+		std::string a = s.substr(0, pos), b = s.substr(pos+strlen(cmps[i]));
+		long x, y;
+		int cmp = (number(a, &x) && number(b, &y)) ? (x>y)-(x<y)
+												   : a.compare(b);
+		switch ( i ) {
+		case 0: return cmp==0;
+		case 1: return cmp!=0;
+		case 2: return cmp<0;
+		case 3: return cmp>0;
+		}
+	}
+	return !s.empty() && s!="0";
+}
+long SCRIPT::count(Fl_Term *term, const OP &op)
+{
+	std::string s = expand(term, op);
+	return s.empty() ? -1 : atol(s.c_str());
+}
+void SCRIPT::run(Fl_Term *term, script_exec *exec, void *data)
+{//commands go to exec if not NULL, to term->exec() otherwise, ops are
+ //only read so one compiled script can run on many terms at once
+	std::vector<std::pair<long, long>> loops;	//count and pass of each loop
+	size_t pc = 0;
+	while ( pc<ops.size() && term->script_running() ) {
+		if ( term->script_paused() ) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
+		const OP &op = ops[pc++];
+		switch ( op.code ) {
+		case OP_CMD: {
+				std::string v;
+				const char *cmd = op.arg.c_str();
+				if ( op.vars ) {
+					v = expand(term, op);
+					cmd = v.c_str();
+				}
+				if ( !(exec==NULL ? term->exec(cmd) : exec(data, cmd)) ) return;
+			}
+			break;
+		case OP_SET: {
+				std::string v = expand(term, op);
+				long x, y;				//simple arithmetic like "${i}+1"
+				char o;
+				int n = 0;
+				if ( sscanf(v.c_str(), "%ld %c %ld%n", &x, &o, &y, &n)==3
+						&& n==(int)v.size() && strchr("+-*/%", o)!=NULL ) {
+					if ( o=='+' ) x += y;
+					if ( o=='-' ) x -= y;
+					if ( o=='*' ) x *= y;
+					if ( (o=='/' || o=='%') && y!=0 ) x = o=='/' ? x/y : x%y;
+					v = std::to_string(x);
+				}
+				term->setvar(op.name.c_str(), v.c_str());
+			}
+			break;
+		case OP_IF:
+			if ( !test(term, op) ) pc = op.jump;
+			break;
+		case OP_ELSE:
+			pc = op.jump;
+			break;
+		case OP_LOOP: {
+				long n = count(term, op);
+				if ( n==0 )
+					pc = op.jump;
+				else {
+					loops.push_back(std::make_pair(n, 1L));
+					term->setvar("loop", "1");
+				}
+			}
+			break;
+		case OP_BREAK:
+			loops.pop_back();
+			pc = op.jump;
+			break;
+		case OP_END:
+			if ( op.jump!=-1 ) {		//end of loop
+				std::pair<long, long> &l = loops.back();
+				l.second++;
+				if ( l.first<0 || l.second<=l.first ) {
+					term->setvar("loop", std::to_string(l.second).c_str());
+					pc = op.jump+1;
+				}
+				else
+					loops.pop_back();
+			}
+			break;
+		}
+	}
+}
@@ -0,0 +1,56 @@
+//
+// "$Id: script.h 6120 2026-10-19 10:12:40 $"
+//
+// SCRIPT -- script compiler and virtual machine
+//
+//	compiles a script to a list of ops once, then runs the ops
+//    on a Fl_Term widget, with variables, conditions and loops
+//
+// Copyright 2017-2026 by Yongchao Fan.
+//
+// This library is free software distributed under GNU GPL 3.0,
+// see the license at:
+//
+//     https://github.com/yongchaofan/tinyTerm2/blob/master/LICENSE
+//
+// Please report all bugs and problems on the following page:
+//
+//     https://github.com/yongchaofan/tinyTerm2/issues/new
+//
+#include <string>
+#include <vector>
+
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+class Fl_Term;
+typedef bool (script_exec)(void *, const char *);	//false stops the script
+
+enum { OP_CMD=0, OP_SET, OP_IF, OP_ELSE, OP_LOOP, OP_BREAK, OP_END };
+
+struct OP {
+	char code;			//OP_CMD etc.
+	bool vars;			//arg has ${name} to expand before use
+	int jump;			//op to continue at for if/else/loop/break/end
+	int line;			//line number in script, for errors
+	std::string name;	//variable name for OP_SET
+	std::string arg;	//command, value, condition or loop count
+};
+
+class SCRIPT {
+private:
+	std::vector<OP> ops;
+	std::vector<int> blocks;	//open if/else/loop ops while compiling
+	std::vector<std::vector<int>> breaks;//break ops of each open loop
+	char err[256];
+
+	int  parse(char *text, int depth);
+	bool test(Fl_Term *term, const OP &op);
+	long count(Fl_Term *term, const OP &op);
+
+public:
+	SCRIPT() { *err = 0; }
+	int  compile(const char *text);	//returns number of ops, -1 if error
+	const char *error() { return err; }
+	void run(Fl_Term *term, script_exec *exec=NULL, void *data=NULL);
+};
+#endif //_SCRIPT_H_
@@ -22,12 +22,18 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include "ssh2.h"
+#include "metrics.h"
 #include <thread>
+#include <vector>
+#include <map>
+#include <string>
+#include <functional>
 
 #ifndef WIN32
 	#include <pwd.h>
 	#include <dirent.h>
 	#include <fnmatch.h>
+	#include <errno.h>
 	#define Sleep(x) usleep((x)*1000);
 #else
 	#define getcwd _getcwd
@@ -119,6 +125,23 @@ int closedir(DIR *dir)
 }
 #endif //WIN32
 
+static void nonblock(int s)
+{
+#ifdef WIN32
+	u_long on = 1;
+	ioctlsocket(s, FIONBIO, &on);
+#else
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL)|O_NONBLOCK);
+#endif
+}
+static bool would_block()
+{
+#ifdef WIN32
+	return WSAGetLastError()==WSAEWOULDBLOCK;
+#else
+	return errno==EAGAIN || errno==EWOULDBLOCK;
+#endif
+}
 static const char *errmsgs[] = {
 "Disconnected", "Connection", "Session failure",
 "Verification failure", "Authentication failure",
@@ -126,6 +149,7 @@ static const char *errmsgs[] = {
 };
 
 const char *kb_gets(unsigned char *prompt, int echo);	//define in tiny2.cxx
+static std::mutex drop_mtx;	//busy-- of detached hosts, outlives them
 sshHost::sshHost(const char *name) : tcpHost(name)
 {
 	port = 0;
@@ -135,6 +159,11 @@ sshHost::sshHost(const char *name) : tcpHost(name)
 	*subsystem = 0;
 	session = NULL;
 	channel = NULL;
+	wake_s = -1;
+	wake_pending = false;
+	pooled = 0;
+	orphan = false;
+	console = NULL;
 
 	char options[256];
 	strncpy(options, name, 255);
@@ -360,6 +389,20 @@ int sshHost::ssh_authentication()
 	memset(passphrase,0,sizeof(passphrase));
 	return rc;
 }
+sshHost::~sshHost()
+{
+	if ( wake_s!=-1 ) closesocket(wake_s);
+}
+void sshHost::wake()
+{
+	if ( wake_s!=-1 && !wake_pending.exchange(true) ) send(wake_s, "w", 1, 0);
+}
+void sshHost::ssh_unlock()
+{//other threads using the session may leave data of the shell channel in
+ //libssh2 buffers, with nothing left on the socket to wake up the reactor
+	mtx.unlock();
+	if ( std::this_thread::get_id()!=reader_id ) wake();
+}
 int sshHost::wait_socket()
 {
 	timeval tv = {0, 10000};	//tv=NULL works on Windows but not MacOS
@@ -377,6 +420,8 @@ const char *IETF_HELLO="<?xml version=\"1.0\" encoding=\"UTF-8\"?>\
 </capabilities></hello>]]>]]>";
 int sshHost::read()
 {
+	reader_id = std::this_thread::get_id();
+	if ( wake_s==-1 ) wake_s = wake_socket();
 	status(HOST_CONNECTING);
 	if ( tcp()==-1 ) goto TCP_Close;
 
@@ -402,6 +447,7 @@ int sshHost::read()
 		term_puts(errmsgs[4], -4);
 		goto Session_Close;
 	}
+	if ( pooled ) goto Connected;	//no shell of its own, borrowers open theirs
 	if ( !(channel=libssh2_channel_open_session(session)) ) {
 		term_puts(errmsgs[5], -5);
 		goto Session_Close;
@@ -423,54 +469,137 @@ int sshHost::read()
 		}
 		libssh2_channel_write(channel, IETF_HELLO, strlen(IETF_HELLO));
 	}
-	libssh2_session_set_blocking(session, 0);
 
+Connected:
+	libssh2_session_set_blocking(session, 0);
+	chan_mtx.lock();
 	status(HOST_CONNECTED);
+	chan_cv.notify_all();
+	chan_mtx.unlock();
 	term_puts("Connected", 0);
-	while ( true ) {
-		char buf[32768];
-		mtx.lock();
-		int len=libssh2_channel_read(channel, buf, 32768);
-		mtx.unlock();
-		if ( len>0 ) {
-			term_puts(buf, len);
-		}
-		else {//len<=0
-			if ( len!=LIBSSH2_ERROR_EAGAIN || wait_socket()<0 ) break;
-		}
-	}
-	term_puts("Disconnected", -1);
-	tun_closeall();
-	*username = 0;
-	*password = 0;
+	watch(sock, wake_s);
+	reader.detach();
+	return 0;
 
 Channel_Close:
 	if ( channel!=NULL ) {
 		mtx.lock();
 		libssh2_channel_close(channel);
-		mtx.unlock();
+		ssh_unlock();
 		channel = NULL;
 	}
 Session_Close:
 	if ( session!=NULL ) {
 		mtx.lock();
 		libssh2_session_free(session);
-		mtx.unlock();
+		ssh_unlock();
 		session = NULL;
 	}
 TCP_Close:
 	closesocket(sock);
+	if ( pooled==1 ) pool_remove();
+	chan_mtx.lock();
 	status(HOST_IDLE);
+	chan_cv.notify_all();
+	chan_mtx.unlock();
 	reader.detach();
 	return 0;
 }
+int sshHost::readable(int fd)
+{
+	reader_id = std::this_thread::get_id();
+	if ( fd==wake_s ) {
+		char buf[64];
+		while ( recv(fd, buf, sizeof(buf), 0)>0 );
+		wake_pending = false;	//after draining, the channel is tried next
+	}
+	else if ( fd!=sock ) {
+		tun_send(fd);
+		return wait_output();
+	}
+	if ( fd==sock && channel==NULL && !in_use() ) return -1;//pooled session,
+									//nothing left to read with, closed by server
+	while ( channel!=NULL ) {
+		char buf[32768];
+		mtx.lock();
+		int len=libssh2_channel_read(channel, buf, 32768);
+		ssh_unlock();
+		if ( len>0 )
+			term_puts(buf, len);
+		else if ( len==LIBSSH2_ERROR_EAGAIN )
+			break;
+		else
+			return -1;
+	}
+	tun_recv();
+	chan_recv();
+	return wait_output();
+}
+int sshHost::wait_output()
+{//only sock, the wake socket and tunnel sockets are writable all the time,
+ //sock is left to borrowers (sftp, scp) when nothing here reads it, or it
+ //stays readable and the reactor spins; drop() wakes to watch it again
+	mtx.lock();
+	int dir = libssh2_session_block_directions(session);
+	ssh_unlock();
+	events(sock, busy==0 || has_readers(),
+					(dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)!=0);
+	return 0;
+}
+void sshHost::detached()
+{
+	if ( pooled==1 ) pool_remove();
+	term_puts("Disconnected", -1);
+	chan_mtx.lock();
+	status(HOST_IDLE);		//no more chan_add(), channels go with session
+	mtx.lock();
+	for ( auto dup : channels ) dup->channel = NULL;
+	ssh_unlock();
+	for ( auto dup : channels ) dup->detached();
+	channels.clear();
+	closing.clear();		//freed with the session
+	chan_cv.notify_all();
+	chan_mtx.unlock();
+	tun_closeall();
+	*username = 0;
+	*password = 0;
+	mtx.lock();
+	if ( channel!=NULL ) libssh2_channel_close(channel);
+	channel = NULL;
+	ssh_unlock();
+	drop_mtx.lock();
+	if ( busy==0 )
+		session_close();
+	else
+		orphan = true;		//borrowers are still in libssh2 calls on it
+	drop_mtx.unlock();
+}
+void sshHost::session_close()
+{
+	mtx.lock();
+	libssh2_session_free(session);
+	session = NULL;
+	mtx.unlock();
+	closesocket(sock);
+}
+void sshHost::drop()
+{//the last borrower frees the session of a detached host, before busy is 0
+ //and this may be deleted or connected again
+	std::lock_guard<std::mutex> lck(drop_mtx);
+	if ( busy==1 && orphan ) {
+		session_close();
+		orphan = false;
+	}
+	if ( busy==1 ) wake();	//sock may be left to borrowers, watch it again
+	busy--;
+}
 int sshHost::write(const char *buf, int len)
 {
 	int total=0, cch=0;
 	while ( total<len && channel!=NULL ) {
 		mtx.lock();
 		cch=libssh2_channel_write(channel, buf+total, len-total);
-		mtx.unlock();
+		ssh_unlock();
 		if ( cch>0 ) {
 			total += cch;
 		}
@@ -485,31 +614,216 @@ void sshHost::send_size(int sx, int sy)
 	mtx.lock();
 	if ( channel!=NULL )
 		libssh2_channel_request_pty_size( channel, sx, sy );
-	mtx.unlock();
+	ssh_unlock();
 }
 void sshHost::keepalive(int interval)
 {//some host will close connection when interval!=0
 	if ( session!=NULL ) {
 		mtx.lock();
 		libssh2_keepalive_config(session, false, interval);
-		mtx.unlock();
+		ssh_unlock();
 	}
 }
 void sshHost::disconn()
 {
-	if ( reader.joinable() ) {
-		if ( channel!=NULL ) {
+	if ( running() ) {
+		mtx.lock();
+		if ( channel!=NULL ) libssh2_channel_send_eof(channel);
+		if ( session!=NULL ) libssh2_session_disconnect(session, "close");
+		ssh_unlock();
+	}
+}
+HOST *sshHost::dup()
+{
+	if ( status()!=HOST_CONNECTED || *subsystem || pooled==2 ) return NULL;
+	busy++;
+	return new sshChannel(this);
+}
+bool sshHost::chan_add(sshChannel *dup)
+{
+	std::lock_guard<std::mutex> lck(chan_mtx);
+	if ( status()!=HOST_CONNECTED ) return false;
+	channels.push_back(dup);
+	dup->reserved = false;	//in channels now, busy no more
+	busy--;
+	return true;
+}
+void sshHost::chan_recv()
+{//data of duplicated shells, each to the term of its own tab
+	char buf[32768];
+	chan_mtx.lock();
+	for ( auto it=channels.begin(); it!=channels.end(); ) {
+		sshChannel *dup = *it;
+		int len;
+		while ( true ) {
 			mtx.lock();
-			libssh2_channel_send_eof(channel);
-			mtx.unlock();
+			len = libssh2_channel_read(dup->channel, buf, 32768);
+			ssh_unlock();
+			if ( len<=0 ) break;
+			dup->term_puts(buf, len);
 		}
-		if ( session!=NULL ) {
-			mtx.lock();
-			libssh2_session_disconnect(session, "close");
-			mtx.unlock();
+		if ( len==LIBSSH2_ERROR_EAGAIN ) {
+			it++;
+			continue;
+		}
+		mtx.lock();
+		closing.push_back(dup->channel);
+		dup->channel = NULL;
+		ssh_unlock();
+		it = channels.erase(it);
+		dup->detached();
+	}
+	for ( auto it=closing.begin(); it!=closing.end(); ) {
+		mtx.lock();
+		int rc = libssh2_channel_free(*it);	//reads the close from server
+		ssh_unlock();
+		if ( rc==LIBSSH2_ERROR_EAGAIN )
+			it++;
+		else
+			it = closing.erase(it);
+	}
+	chan_mtx.unlock();
+}
+/*******************session pool***************************/
+int ssh_pool_idle = 60;
+struct POOLED {
+	sshHost *ssh;
+	int idle;			//seconds not in use
+};
+static std::mutex pool_mtx;	//to protect ssh_pool and retired
+static std::map<std::string, POOLED> ssh_pool;	//by user@host:port#identity
+static std::list<sshHost *> retired;	//deleted once not live or borrowed
+static bool reaper_started = false;
+
+HOST *sshHost::pool_borrow(const char *name)
+{//a tab on a pooled session, the session is made on the first borrow
+	sshHost *ssh = pool_get(name);
+	return ssh==NULL ? NULL : new sshChannel(ssh, name);
+}
+sshHost *sshHost::pool_get(const char *name)
+{//pooled session for name, with busy counted for the borrower
+	if ( ssh_pool_idle<=0 ) return NULL;
+	sshHost *ssh = new sshHost(name);
+	if ( *ssh->subsystem ) {		//netconf, a session of its own
+		delete ssh;
+		return NULL;
+	}
+	char key[256];					//no user: whoever logs in first
+	int len = snprintf(key, 256, "%s@%s:%d",
+						ssh->username, ssh->hostname, ssh->port);
+	if ( *ssh->password || *ssh->passphrase ) {	//other identity, other session
+		std::string id = std::string(ssh->password)+'\n'+ssh->passphrase;
+		snprintf(key+len, 256-len, "#%zx", std::hash<std::string>()(id));
+	}
+
+	std::lock_guard<std::mutex> lck(pool_mtx);
+	if ( !reaper_started ) {
+		std::thread reaper(&sshHost::pool_reaper);
+		reaper.detach();
+		reaper_started = true;
+	}
+	auto it = ssh_pool.find(key);
+	if ( it!=ssh_pool.end() ) {
+		delete ssh;
+		ssh = it->second.ssh;
+	}
+	else {
+		ssh->pooled = 1;
+		ssh->callback(pool_puts, pool_gets, pool_ask, ssh);
+		ssh_pool[key] = { ssh, 0 };
+	}
+	ssh->busy++;
+	return ssh;
+}
+void sshHost::pool_reaper()
+{//disconnects pooled sessions unused for ssh_pool_idle seconds
+	while ( true ) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		std::lock_guard<std::mutex> lck(pool_mtx);
+		for ( auto &it : ssh_pool ) {
+			sshHost *ssh = it.second.ssh;
+			if ( ssh->status()!=HOST_CONNECTED || ssh->in_use() )
+				it.second.idle = 0;
+			else if ( ++it.second.idle==ssh_pool_idle )
+				ssh->disconn();
+		}
+		for ( auto it=retired.begin(); it!=retired.end(); ) {
+			if ( !(*it)->live() ) {
+				delete *it;
+				it = retired.erase(it);
+			}
+			else
+				it++;
 		}
 	}
 }
+void sshHost::pool_remove()
+{//session is gone or failed, new borrowers get a new one
+	std::lock_guard<std::mutex> lck(pool_mtx);
+	for ( auto it=ssh_pool.begin(); it!=ssh_pool.end(); it++ )
+		if ( it->second.ssh==this ) {
+			ssh_pool.erase(it);
+			break;
+		}
+	retired.push_back(this);
+	pooled = 2;
+}
+bool sshHost::in_use()
+{
+	return busy>0 || has_readers();
+}
+bool sshHost::has_readers()
+{
+	if ( channel!=NULL ) return true;
+	std::lock_guard<std::mutex> lck(chan_mtx);
+	if ( !channels.empty() || !closing.empty() ) return true;
+	std::lock_guard<std::mutex> lck2(tunnel_mtx);
+	return !tunnel_list.empty();
+}
+bool sshHost::borrow(HOST *borrower)
+{//connect a pooled session if it's not yet, login prompts go to borrower
+	std::unique_lock<std::mutex> lck(chan_mtx);
+	bool starter = false;
+	if ( pooled==1 && status()==HOST_IDLE && !running() ) {
+		console_set(borrower);
+		status(HOST_CONNECTING);
+		start();					//busy with this borrower already
+		starter = true;
+	}
+	while ( status()!=HOST_CONNECTED && status()!=HOST_IDLE )
+		chan_cv.wait_for(lck, std::chrono::seconds(1));
+	console_mtx.lock();
+	if ( console==borrower ) console = NULL;
+	console_mtx.unlock();
+	if ( status()==HOST_CONNECTED ) return true;
+	if ( !starter ) borrower->term_puts(errmsgs[1], -1);//starter has been
+	return false;										//told why already
+}
+void sshHost::console_set(HOST *borrower)
+{
+	std::lock_guard<std::mutex> lck(console_mtx);
+	console = borrower;
+}
+void sshHost::pool_puts(void *data, const char *buf, int len)
+{
+	sshHost *ssh = (sshHost *)data;
+	if ( len==0 ) return;				//Connected, each borrower says its own
+	std::lock_guard<std::mutex> lck(ssh->console_mtx);
+	if ( ssh->console!=NULL ) ssh->console->term_puts(buf, len);
+}
+char *sshHost::pool_gets(void *data, const char *prompt, bool echo)
+{
+	sshHost *ssh = (sshHost *)data;
+	std::lock_guard<std::mutex> lck(ssh->console_mtx);
+	if ( ssh->console==NULL ) return NULL;
+	return ssh->console->term_gets(prompt, echo);
+}
+void sshHost::pool_ask(void *data, const char *prompt, bool echo)
+{
+	sshHost *ssh = (sshHost *)data;
+	std::lock_guard<std::mutex> lck(ssh->console_mtx);
+	if ( ssh->console!=NULL ) ssh->console->term_ask(prompt, echo);
+}
 void sshHost::print_total(time_t start, long total)
 {
 	double duration = difftime(time(NULL), start);
@@ -526,7 +840,7 @@ int sshHost::scp_read_one(const char *rpath, const char *lpath)
 		mtx.lock();
 		scp_channel = libssh2_scp_recv2(session, rpath, &fileinfo);
 		if ( !scp_channel ) err_no = libssh2_session_last_errno(session);
-		mtx.unlock();
+		ssh_unlock();
 		if (!scp_channel) {
 			if ( err_no==LIBSSH2_ERROR_EAGAIN)
 				if ( wait_socket()>=0 ) continue;
@@ -539,6 +853,7 @@ int sshHost::scp_read_one(const char *rpath, const char *lpath)
 	if ( fp!=NULL ) {
 		int blocks = 0;
 		time_t start = time(NULL);
+		double t0 = metric_clock();
 		libssh2_struct_stat_size total = 0;
 		libssh2_struct_stat_size fsize = fileinfo.st_size;
 		while  ( total<fsize ) {
@@ -549,9 +864,10 @@ int sshHost::scp_read_one(const char *rpath, const char *lpath)
 			}
 			mtx.lock();
 			int rc = libssh2_channel_read(scp_channel, mem, amount);
-			mtx.unlock();
+			ssh_unlock();
 			if ( rc>0 ) {
 				int nwrite = fwrite(mem, 1,rc,fp);
+				metric_add(app_metrics().xfer_bytes[XFER_SCP_GET], rc);
 				if ( nwrite>0 ) {
 					total += nwrite;
 					if ( ++blocks==32 ) {
@@ -572,6 +888,7 @@ int sshHost::scp_read_one(const char *rpath, const char *lpath)
 			}
 		}
 		fclose(fp);
+		metric_xfer_done(XFER_SCP_GET, t0);
 		if ( total==fsize ) print_total(start, total);
 	}
 	else
@@ -580,7 +897,7 @@ int sshHost::scp_read_one(const char *rpath, const char *lpath)
 	mtx.lock();
 	libssh2_channel_close(scp_channel);
 	libssh2_channel_free(scp_channel);
-	mtx.unlock();
+	ssh_unlock();
 	return 0;
 }
 int sshHost::scp_write_one(const char *lpath, const char *rpath)
@@ -601,7 +918,7 @@ int sshHost::scp_write_one(const char *lpath, const char *rpath)
 		scp_channel = libssh2_scp_send(session, rpath, fileinfo.st_mode&0777,
 						   (unsigned long)fileinfo.st_size);
 		if ( !scp_channel ) err_no = libssh2_session_last_errno(session);
-		mtx.unlock();
+		ssh_unlock();
 		if ( !scp_channel ) {
 			if ( err_no!=LIBSSH2_ERROR_EAGAIN || wait_socket()<0 ) {
 				print("\033[31mcouldn't open remote file");
@@ -612,6 +929,7 @@ int sshHost::scp_write_one(const char *lpath, const char *rpath)
 	} while ( !scp_channel );
 	int rc, blocks = 0;
 	time_t start = time(NULL);
+	double t0 = metric_clock();
 	size_t nread = 0;
 	long total = 0;
 	char mem[1024*32];
@@ -620,11 +938,12 @@ int sshHost::scp_write_one(const char *lpath, const char *rpath)
 		while ( nread>0 ) {
 			mtx.lock();
 			rc = libssh2_channel_write(scp_channel, ptr, nread);
-			mtx.unlock();
+			ssh_unlock();
 			if ( rc>0 ) {
 				ptr += rc;
 				nread -= rc;
 				total += rc;
+				metric_add(app_metrics().xfer_bytes[XFER_SCP_PUT], rc);
 			}
 			else {
 				if ( rc!=LIBSSH2_ERROR_EAGAIN || wait_socket()<0 ) break;
@@ -643,26 +962,27 @@ int sshHost::scp_write_one(const char *lpath, const char *rpath)
 	}
 	if ( nread==0 ) print_total(start, total);	//file completed
 	fclose(fp);
+	metric_xfer_done(XFER_SCP_PUT, t0);
 
 	do {
 		mtx.lock();
 		rc = libssh2_channel_send_eof(scp_channel);
-		mtx.unlock();
+		ssh_unlock();
 	} while ( rc==LIBSSH2_ERROR_EAGAIN );
 	do {
 		mtx.lock();
 		rc = libssh2_channel_wait_eof(scp_channel);
-		mtx.unlock();
+		ssh_unlock();
 	} while ( rc==LIBSSH2_ERROR_EAGAIN );
 	do {
 		mtx.lock();
 		rc = libssh2_channel_wait_closed(scp_channel);
-		mtx.unlock();
+		ssh_unlock();
 	} while ( rc == LIBSSH2_ERROR_EAGAIN);
 	mtx.lock();
 	libssh2_channel_close(scp_channel);
 	libssh2_channel_free(scp_channel);
-	mtx.unlock();
+	ssh_unlock();
 	return 0;
 }
 int sshHost::scp_read(char *lpath, char *rpath)
@@ -797,6 +1117,7 @@ TUNNEL *sshHost::tun_add(int tun_sock, LIBSSH2_CHANNEL *tun_channel,
 	if ( tun!=NULL ) {
 		tun->socket = tun_sock;
 		tun->channel = tun_channel;
+		tun->eof = false;
 		tun->localip = strdup(localip);
 		tun->localport = localport;
 		tun->remoteip = strdup(remoteip);
@@ -804,6 +1125,8 @@ TUNNEL *sshHost::tun_add(int tun_sock, LIBSSH2_CHANNEL *tun_channel,
 		tunnel_mtx.lock();
 		tunnel_list.insert(tunnel_list.end(), tun);
 		tunnel_mtx.unlock();
+		app_metrics().tunnels_open++;
+		metric_add(app_metrics().tunnels_total, 1);
 		print("\r\n\033[32mtunnel %d %s:%d %s:%d\r\n", tun_sock,
 						localip, localport, remoteip, remoteport);
 	}
@@ -819,6 +1142,7 @@ void sshHost::tun_del(int tun_sock)
 			free(tun->remoteip);
 			delete(tun);
 			tunnel_list.erase(it);
+			app_metrics().tunnels_open--;
 			print("\r\n\033[32mtunnel %d closed\r\n", tun_sock);
 			break;
 		}
@@ -826,54 +1150,118 @@ void sshHost::tun_del(int tun_sock)
 	tunnel_mtx.unlock();
 }
 void sshHost::tun_closeall()
+{//listeners are closed for tun_local() to return, active tunnels right here
+	std::vector<std::pair<int, LIBSSH2_CHANNEL *>> active;
+	tunnel_mtx.lock();
+	for ( auto &tun : tunnel_list ) {
+		if ( tun->channel==NULL )
+			closesocket(tun->socket);
+		else
+			active.push_back(std::make_pair(tun->socket, tun->channel));
+	}
+	tunnel_mtx.unlock();
+	for ( auto &tun : active ) tun_close(tun.first, tun.second);
+}
+void sshHost::tun_close(int tun_sock, LIBSSH2_CHANNEL *tun_channel)
 {
+	unwatch(tun_sock);
+	mtx.lock();
+	libssh2_channel_close(tun_channel);
+	libssh2_channel_free(tun_channel);
+	ssh_unlock();
+	closesocket(tun_sock);
+	tun_del(tun_sock);
+}
+bool sshHost::tun_flush(TUNNEL *tun)
+{//pending data both ways, false once the tunnel is closed
+	while ( !tun->to_chan.empty() ) {
+		mtx.lock();
+		int i = libssh2_channel_write(tun->channel, tun->to_chan.data(),
+												tun->to_chan.size());
+		ssh_unlock();
+		if ( i==LIBSSH2_ERROR_EAGAIN ) break;
+		if ( i<0 ) {
+			tun->to_chan.clear();
+			tun->to_sock.clear();
+			tun->eof = true;
+			break;
+		}
+		tun->to_chan.erase(0, i);
+	}
+	while ( !tun->to_sock.empty() ) {
+		int i = send(tun->socket, tun->to_sock.data(), tun->to_sock.size(), 0);
+		if ( i<0 && would_block() ) break;
+		if ( i<=0 ) {
+			tun->to_chan.clear();
+			tun->to_sock.clear();
+			tun->eof = true;
+			break;
+		}
+		tun->to_sock.erase(0, i);
+	}
+	if ( tun->eof && tun->to_chan.empty() && tun->to_sock.empty() ) {
+		tun_close(tun->socket, tun->channel);
+		return false;
+	}
+	events(tun->socket, tun->to_chan.empty()&&!tun->eof, !tun->to_sock.empty());
+	return true;
+}
+void sshHost::tun_send(int tun_sock)
+{//local end of a tunnel is readable, or writable with data pending for it
+	TUNNEL *tun = NULL;
 	tunnel_mtx.lock();
-	for ( auto &tun : tunnel_list ) closesocket(tun->socket);
+	for ( auto t : tunnel_list )
+		if ( t->socket==tun_sock && t->channel!=NULL ) tun = t;
 	tunnel_mtx.unlock();
+	if ( tun==NULL ) return;	//active tunnels are deleted by this thread only
+
+	if ( tun->to_chan.empty() && !tun->eof ) {
+		char buff[16384];
+		int len = recv(tun_sock, buff, sizeof(buff), 0);
+		if ( len>0 ) {
+			metric_add(app_metrics().tunnel_bytes_out, len);
+			tun->to_chan.assign(buff, len);
+		}
+		else if ( len==0 || !would_block() )
+			tun->eof = true;
+	}
+	else if ( tun->to_sock.empty() ) {	//nothing was asked for, reset by peer
+		int err = 0;
+		socklen_t size = sizeof(err);
+		getsockopt(tun_sock, SOL_SOCKET, SO_ERROR, (char *)&err, &size);
+		if ( err!=0 ) {
+			tun->to_chan.clear();
+			tun->eof = true;
+		}
+	}
+	tun_flush(tun);
 }
+void sshHost::tun_recv()
+{//data of all tunnel channels after the session socket is read, a channel
+ //is not read while its socket has data pending, libssh2 holds the rest
+	std::vector<TUNNEL *> active;
+	tunnel_mtx.lock();
+	for ( auto tun : tunnel_list )
+		if ( tun->channel!=NULL ) active.push_back(tun);
+	tunnel_mtx.unlock();
 
-void sshHost::tun_worker(int tun_sock, LIBSSH2_CHANNEL *tun_channel)
-{
 	char buff[16384];
-	while ( true ) {
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(sock, &fds);
-		FD_SET(tun_sock, &fds);
-		int rc = select(tun_sock + 1, &fds, NULL, NULL, NULL);
-		if ( rc==-1 ) break;
-		if ( rc==0 ) continue;
-		if ( FD_ISSET(tun_sock, &fds) ) {
-			int len = recv(tun_sock, buff, sizeof(buff), 0);
-			if ( len<=0 ) break;
-			for ( int wr=0, i=0; wr<len; wr+=i ) {
-				mtx.lock();
-				i = libssh2_channel_write(tun_channel, buff+wr, len-wr);
-				mtx.unlock();
-				if ( i==LIBSSH2_ERROR_EAGAIN ) { i=0; continue; }
-				if ( i<=0 ) goto shutdown;
-			}
-		}
-		if ( FD_ISSET(sock, &fds) ) while ( true )
-		{
+	for ( auto tun : active ) {
+		bool open = tun_flush(tun);
+		while ( open && tun->to_sock.empty() && !tun->eof ) {
 			mtx.lock();
-			int len = libssh2_channel_read(tun_channel, buff, sizeof(buff));
-			mtx.unlock();
+			int len = libssh2_channel_read(tun->channel, buff, sizeof(buff));
+			ssh_unlock();
 			if ( len==LIBSSH2_ERROR_EAGAIN ) break;
-			if ( len<=0 ) goto shutdown;
-			for ( int wr=0, i=0; wr<len; wr+=i ) {
-				i = send(tun_sock, buff + wr, len - wr, 0);
-				if ( i<=0 ) break;
+			if ( len<=0 )
+				tun->eof = true;
+			else {
+				metric_add(app_metrics().tunnel_bytes_in, len);
+				tun->to_sock.assign(buff, len);
 			}
+			open = tun_flush(tun);
 		}
 	}
-shutdown:
-	mtx.lock();
-	libssh2_channel_close(tun_channel);
-	libssh2_channel_free(tun_channel);
-	mtx.unlock();
-	closesocket(tun_sock);
-	tun_del(tun_sock);
 }
 int sshHost::tun_local(char *parameters)
 {//parameters example: 127.0.0.1:2222 127.0.0.1:22
@@ -927,7 +1315,7 @@ int sshHost::tun_local(char *parameters)
 			tun_channel = libssh2_channel_direct_tcpip_ex(session,
 									dhost, dport, client_host, client_port);
 			if (!tun_channel) rc = libssh2_session_last_errno(session);
-			mtx.unlock();
+			ssh_unlock();
 			if ( !tun_channel ) {
 				if ( rc==LIBSSH2_ERROR_EAGAIN )
 					if ( wait_socket()>=0 ) continue;
@@ -936,9 +1324,9 @@ int sshHost::tun_local(char *parameters)
 				goto shutdown;
 			}
 		} while ( !tun_channel );
+		nonblock(tun_sock);
 		tun_add(tun_sock, tun_channel, client_host, client_port, dhost, dport);
-		std::thread tun_thread(&sshHost::tun_worker,this,tun_sock,tun_channel);
-		tun_thread.detach();
+		watch(tun_sock);
 	}
 shutdown:
 	closesocket(listensock);
@@ -970,7 +1358,7 @@ int sshHost::tun_remote(char *parameters)
 		listener = libssh2_channel_forward_listen_ex(session, shost,
 										sport, &r_listenport, 1);
 		if ( !listener ) err_no = libssh2_session_last_errno(session);
-		mtx.unlock();
+		ssh_unlock();
 		if (!listener) {
 			if ( err_no==LIBSSH2_ERROR_EAGAIN )
 				if ( wait_socket()>=0 ) continue;
@@ -985,7 +1373,7 @@ again:
 		mtx.lock();
 		tun_channel = libssh2_channel_forward_accept(listener);
 		if ( !tun_channel ) err_no = libssh2_session_last_errno(session);
-		mtx.unlock();
+		ssh_unlock();
 		if (!tun_channel) {
 			if ( err_no==LIBSSH2_ERROR_EAGAIN )
 				if ( wait_socket()>=0 ) continue;
@@ -1002,10 +1390,9 @@ again:
 		freeaddrinfo(ainfo);
 
 		if ( rc==0 ) {
+			nonblock(tun_sock);
 			tun_add(tun_sock, tun_channel, shost, r_listenport, dhost, dport);
-			std::thread tun_thread(&sshHost::tun_worker, this, tun_sock,
-																tun_channel);
-			tun_thread.detach();
+			watch(tun_sock);
 			goto again;
 		}
 		else {
@@ -1018,7 +1405,7 @@ again:
 	}
 	mtx.lock();
 	libssh2_channel_forward_cancel(listener);
-	mtx.unlock();
+	ssh_unlock();
 	return 0;
 }
 void sshHost::tun(const char *cmd)
@@ -1034,7 +1421,12 @@ void sshHost::tun(const char *cmd)
 			int sock = atoi(cmd);
 			tunnel_mtx.lock();
 			for ( auto &tun : tunnel_list ) 
-				if ( tun->socket==sock ) closesocket(sock);
+				if ( tun->socket==sock ) {
+					if ( tun->channel==NULL )
+						closesocket(sock);
+					else			//readable() gets 0 and closes it
+						shutdown(sock, 2);	//SD_BOTH/SHUT_RDWR=2
+				}
 			tunnel_mtx.unlock();
 		}
 	}
@@ -1057,7 +1449,198 @@ void sshHost::tun(const char *cmd)
 	}
 	write("\r", 1);
 }
+/*******************sshChannel*****************************/
+sshChannel::sshChannel(sshHost *ssh, const char *name) : HOST()
+{//busy of ssh is already counted for this, keeping the session till
+ //the channel is open
+	strncpy(hostname, ssh->name(), 127);
+	hostname[127] = 0;
+	strncpy(options, name, 255);
+	options[255] = 0;
+	master = ssh;
+	channel = NULL;
+	reserved = true;
+}
+sshChannel::~sshChannel()
+{
+	release();
+}
+void sshChannel::release()
+{//master may be deleted once released
+	master_mtx.lock();
+	sshHost *ssh = reserved ? master : NULL;
+	master = NULL;
+	reserved = false;
+	master_mtx.unlock();
+	if ( ssh!=NULL ) ssh->drop();
+}
+sshHost *sshChannel::hold()
+{
+	std::lock_guard<std::mutex> lck(master_mtx);
+	if ( master!=NULL ) master->busy++;
+	return master;
+}
+int sshChannel::read()
+{//master is held by reserved, till chan_add() or release()
+	int rc = 0;
+	if ( master==NULL ) {		//reconnect, pooled only
+		sshHost *ssh = *options ? sshHost::pool_get(options) : NULL;
+		if ( ssh==NULL ) {
+			term_puts(errmsgs[0], -1);
+			reader.detach();
+			return 0;
+		}
+		master_mtx.lock();
+		master = ssh;
+		reserved = true;
+		master_mtx.unlock();
+	}
+	status(HOST_CONNECTING);
+	if ( !master->borrow(this) ) goto Channel_Fail;
+	do {
+		master->mtx.lock();
+		channel = libssh2_channel_open_session(master->session);
+		if ( channel==NULL ) rc = libssh2_session_last_errno(master->session);
+		master->ssh_unlock();
+	} while ( channel==NULL && rc==LIBSSH2_ERROR_EAGAIN
+								&& master->wait_socket()>=0 );
+	if ( channel==NULL ) {
+		term_puts(errmsgs[5], -5);
+		goto Channel_Fail;
+	}
+	do {
+		master->mtx.lock();
+		rc = libssh2_channel_request_pty(channel, "xterm");
+		master->ssh_unlock();
+	} while ( rc==LIBSSH2_ERROR_EAGAIN && master->wait_socket()>=0 );
+	if ( rc!=0 ) {
+		term_puts(errmsgs[6], -6);
+		goto Channel_Close;
+	}
+	do {
+		master->mtx.lock();
+		rc = libssh2_channel_shell(channel);
+		master->ssh_unlock();
+	} while ( rc==LIBSSH2_ERROR_EAGAIN && master->wait_socket()>=0 );
+	if ( rc!=0 ) {
+		term_puts(errmsgs[7], -7);
+		goto Channel_Close;
+	}
+
+	status(HOST_CONNECTED);
+	watched = true;			//read by master from now on
+	term_puts("Connected", 0);
+	if ( master->chan_add(this) ) {
+		reader.detach();
+		return 0;
+	}
+	watched = false;
+	channel = NULL;			//master is closing, freed with its session
+	term_puts(errmsgs[0], -1);
+	goto Channel_Fail;
+
+Channel_Close:
+	master->mtx.lock();
+	libssh2_channel_free(channel);
+	master->ssh_unlock();
+	channel = NULL;
+Channel_Fail:
+	release();
+	status(HOST_IDLE);
+	reader.detach();
+	return 0;
+}
+int sshChannel::write(const char *buf, int len)
+{
+	int total=0, cch=0;
+	sshHost *ssh = hold();
+	if ( ssh==NULL ) return -1;
+	while ( total<len ) {
+		ssh->mtx.lock();
+		cch = channel==NULL ? -1 :
+				libssh2_channel_write(channel, buf+total, len-total);
+		ssh->ssh_unlock();
+		if ( cch>0 ) {
+			total += cch;
+		}
+		else  {
+			if ( cch!=LIBSSH2_ERROR_EAGAIN || ssh->wait_socket()<0 ) break;
+		}
+	}
+	ssh->drop();
+	return cch<0 ? cch : total;
+}
+void sshChannel::send_size(int sx, int sy)
+{
+	sshHost *ssh = hold();
+	if ( ssh==NULL ) return;
+	ssh->mtx.lock();
+	if ( channel!=NULL )
+		libssh2_channel_request_pty_size( channel, sx, sy );
+	ssh->ssh_unlock();
+	ssh->drop();
+}
+void sshChannel::disconn()
+{//master sees the channel closed and calls detached()
+	sshHost *ssh = hold();
+	if ( ssh==NULL ) return;
+	ssh->mtx.lock();
+	if ( channel!=NULL ) libssh2_channel_close(channel);
+	ssh->ssh_unlock();
+	ssh->drop();
+}
+HOST *sshChannel::dup()
+{
+	sshHost *ssh = hold();
+	if ( ssh==NULL ) return NULL;
+	HOST *host = ssh->dup();
+	ssh->drop();
+	return host;
+}
+void sshChannel::command(const char *cmd)
+{//scp and tun run on the session of master, printing to this tab if pooled
+	sshHost *ssh = hold();
+	if ( ssh==NULL ) return;
+	ssh->cmd_mtx.lock();
+	ssh->console_set(this);
+	ssh->command(cmd);
+	ssh->console_set(NULL);
+	ssh->cmd_mtx.unlock();
+	ssh->drop();
+	write("\r", 1);
+}
+void sshChannel::send_file(char *src, char *dst)
+{
+	sshHost *ssh = hold();
+	if ( ssh==NULL ) return;
+	ssh->cmd_mtx.lock();
+	ssh->console_set(this);
+	ssh->send_file(src, dst);
+	ssh->console_set(NULL);
+	ssh->cmd_mtx.unlock();
+	ssh->drop();
+}
+void sshChannel::detached()
+{//called by master with chan_mtx locked, channel freed or about to be
+	channel = NULL;
+	master_mtx.lock();
+	master = NULL;			//held ones are kept till drop()
+	master_mtx.unlock();
+	status(HOST_IDLE);
+	term_puts(errmsgs[0], -1);
+	watched = false;		//last touch, the tab may delete this after
+}
 /*******************sftpHost*******************************/
+//sftp_session is on the session of ssh, blocking if it's this, or a pooled
+//one shared with the reactor and other borrowers, mtx is taken per call
+#define SSH_TRY(ssh, rc, call) do { (ssh)->mtx.lock(); rc = (call); \
+			(ssh)->ssh_unlock(); } while ( rc==LIBSSH2_ERROR_EAGAIN \
+											&& (ssh)->wait_socket()>=0 )
+#define SSH_OPEN(ssh, p, call) do { int err_=0; (ssh)->mtx.lock(); \
+			p = (call); if ( p==NULL ) \
+			err_ = libssh2_session_last_errno((ssh)->session); \
+			(ssh)->ssh_unlock(); if ( p!=NULL || err_!=LIBSSH2_ERROR_EAGAIN ) \
+			break; } while ( (ssh)->wait_socket()>=0 )
 void sftpHost::sftp_lcd(char *cmd)
 {
 	char buf[4096];
@@ -1074,10 +1657,13 @@ void sftpHost::sftp_cd(char *path)
 	char newpath[1024];
 	if ( path!=NULL ) {
 		LIBSSH2_SFTP_HANDLE *sftp_handle;
-		if ((sftp_handle=libssh2_sftp_opendir(sftp_session, path))!=NULL ) {
-			libssh2_sftp_closedir(sftp_handle);
-			if ( libssh2_sftp_realpath(sftp_session, path, newpath, 1024)>0 )
-				strcpy(realpath, newpath);
+		SSH_OPEN(ssh, sftp_handle, libssh2_sftp_opendir(sftp_session, path));
+		if ( sftp_handle!=NULL ) {
+			int rc;
+			SSH_TRY(ssh, rc, libssh2_sftp_closedir(sftp_handle));
+			SSH_TRY(ssh, rc, libssh2_sftp_realpath(sftp_session, path,
+															newpath, 1024));
+			if ( rc>0 ) strcpy(realpath, newpath);
 		}
 		else {
 			print("\033[31mCouldn't change dir to \033[32m%s\r\n", path);
@@ -1094,14 +1680,15 @@ void sftpHost::sftp_ls(char *path, bool ll)
 	char *pattern = NULL;
 	char root[2] = "/";
 	LIBSSH2_SFTP_HANDLE *sftp_handle;
-	if ( (sftp_handle=libssh2_sftp_opendir(sftp_session, path))==NULL ) {
+	SSH_OPEN(ssh, sftp_handle, libssh2_sftp_opendir(sftp_session, path));
+	if ( sftp_handle==NULL ) {
 		pattern = strrchr(path, '/');
 		if ( pattern!=path )
 			*pattern = 0;
 		else
 			path = root;
 		pattern++;
-		sftp_handle=libssh2_sftp_opendir(sftp_session, path);
+		SSH_OPEN(ssh, sftp_handle, libssh2_sftp_opendir(sftp_session, path));
 	}
 
 	if ( sftp_handle==NULL ) {
@@ -1112,8 +1699,11 @@ void sftpHost::sftp_ls(char *path, bool ll)
 	char mem[512], longentry[512];
 	std::list<direntry *> dirlist;
 	auto it = dirlist.begin();
-	while ( libssh2_sftp_readdir_ex(sftp_handle, mem, sizeof(mem),
-							longentry, sizeof(longentry), &attrs)>0 ) {
+	int rc;
+	while ( true ) {
+		SSH_TRY(ssh, rc, libssh2_sftp_readdir_ex(sftp_handle, mem, sizeof(mem),
+								longentry, sizeof(longentry), &attrs));
+		if ( rc<=0 ) break;
 		if ( pattern==NULL || fnmatch(pattern, mem, 0)==0 ) {
 			direntry *newentry = new direntry;
 			strcpy(newentry->shortentry, mem);
@@ -1132,12 +1722,14 @@ void sftpHost::sftp_ls(char *path, bool ll)
 		print("%s\r\n", ll? (*it)->longentry : (*it)->shortentry);
 		delete(*it);
 	}
-	libssh2_sftp_closedir(sftp_handle);
+	SSH_TRY(ssh, rc, libssh2_sftp_closedir(sftp_handle));
 }
 void sftpHost::sftp_rm(char *path)
 {
+	int rc;
 	if ( strchr(path, '*')==NULL && strchr(path, '?')==NULL ) {
-		if ( libssh2_sftp_unlink(sftp_session, path) )
+		SSH_TRY(ssh, rc, libssh2_sftp_unlink(sftp_session, path));
+		if ( rc )
 			print("\033[31mcouldn't delete file\033[32m%s\r\n", path);
 		return;
 	}
@@ -1146,47 +1738,57 @@ void sftpHost::sftp_rm(char *path)
 	LIBSSH2_SFTP_HANDLE *sftp_handle;
 	char *pattern = strrchr(path, '/');
 	if ( pattern!=path ) *pattern++ = 0;
-	sftp_handle = libssh2_sftp_opendir(sftp_session, path);
+	SSH_OPEN(ssh, sftp_handle, libssh2_sftp_opendir(sftp_session, path));
 	if ( !sftp_handle ) {
 		print("\033[31munable to open dir \033[32m%s\r\n", path);
 		return;
 	}
 
-	while ( libssh2_sftp_readdir(sftp_handle, mem, sizeof(mem), &attrs)>0 ) {
+	while ( true ) {
+		SSH_TRY(ssh, rc, libssh2_sftp_readdir(sftp_handle, mem, sizeof(mem),
+																&attrs));
+		if ( rc<=0 ) break;
 		if ( fnmatch(pattern, mem, 0)==0 ) {
 			strcpy(rfile, path);
 			strcat(rfile, "/");
 			strcat(rfile, mem);
-			if ( libssh2_sftp_unlink(sftp_session, rfile) )
+			SSH_TRY(ssh, rc, libssh2_sftp_unlink(sftp_session, rfile));
+			if ( rc )
 				print("\033[31mcouldn't delete \033[32m%s\r\n", rfile);
 		}
 	}
-	libssh2_sftp_closedir(sftp_handle);
+	SSH_TRY(ssh, rc, libssh2_sftp_closedir(sftp_handle));
 }
 void sftpHost::sftp_md(char *path)
 {
-	int rc = libssh2_sftp_mkdir(sftp_session, path,
+	int rc;
+	SSH_TRY(ssh, rc, libssh2_sftp_mkdir(sftp_session, path,
 							LIBSSH2_SFTP_S_IRWXU|
 							LIBSSH2_SFTP_S_IRGRP|LIBSSH2_SFTP_S_IXGRP|
-							LIBSSH2_SFTP_S_IROTH|LIBSSH2_SFTP_S_IXOTH);
+							LIBSSH2_SFTP_S_IROTH|LIBSSH2_SFTP_S_IXOTH));
 	if ( rc )
 		print("\033[31mcouldn't create directory\033[32m%s\r\n", path);
 }
 void sftpHost::sftp_rd(char *path)
 {
-	if ( libssh2_sftp_rmdir(sftp_session, path) )
+	int rc;
+	SSH_TRY(ssh, rc, libssh2_sftp_rmdir(sftp_session, path));
+	if ( rc )
 		print("\033[31mcouldn't remove dir \033[32m%s, is it empty?\r\n",path);
 }
 void sftpHost::sftp_ren(char *src, char *dst)
 {
-	if ( libssh2_sftp_rename(sftp_session, src, dst) )
+	int rc;
+	SSH_TRY(ssh, rc, libssh2_sftp_rename(sftp_session, src, dst));
+	if ( rc )
 		print("\033[31mcouldn't rename file \033[32m%s\r\n", src);
 }
 void sftpHost::sftp_get_one(char *src, char *dst)
 {
 	print("get %s\t\t\t", dst);
-	LIBSSH2_SFTP_HANDLE *sftp_handle=libssh2_sftp_open(sftp_session,
-											src, LIBSSH2_FXF_READ, 0);
+	LIBSSH2_SFTP_HANDLE *sftp_handle;
+	SSH_OPEN(ssh, sftp_handle, libssh2_sftp_open(sftp_session,
+											src, LIBSSH2_FXF_READ, 0));
 
 	if (!sftp_handle) {
 		print("\033[31mcouldn't open remote file\r\n");
@@ -1195,7 +1797,8 @@ void sftpHost::sftp_get_one(char *src, char *dst)
 	FILE *fp = fopen(dst, "wb");
 	if ( fp==NULL ) {
 		print("\033[31mcouldn't open local file\r\n");
-		libssh2_sftp_close(sftp_handle);
+		int rc;
+		SSH_TRY(ssh, rc, libssh2_sftp_close(sftp_handle));
 		return;
 	}
 
@@ -1203,8 +1806,12 @@ void sftpHost::sftp_get_one(char *src, char *dst)
 	long total=0;
 	char mem[1024*32];
 	time_t start = time(NULL);
-	while ( (rc=libssh2_sftp_read(sftp_handle, mem, 1024*32))>0 ) {
+	double t0 = metric_clock();
+	while ( true ) {
+		SSH_TRY(ssh, rc, libssh2_sftp_read(sftp_handle, mem, 1024*32));
+		if ( rc<=0 ) break;
 		int nwrite = fwrite(mem, 1, rc, fp);
+		metric_add(app_metrics().xfer_bytes[XFER_SFTP_GET], rc);
 		if ( nwrite>0 ) {
 			total += nwrite;
 			if ( ++blocks==32 ) {
@@ -1218,17 +1825,20 @@ void sftpHost::sftp_get_one(char *src, char *dst)
 		}
 	}
 	fclose(fp);
-	libssh2_sftp_close(sftp_handle);
+	int rc1;
+	SSH_TRY(ssh, rc1, libssh2_sftp_close(sftp_handle));
+	metric_xfer_done(XFER_SFTP_GET, t0);
 	if ( rc==0 ) print_total(start, total);
 	print("\r\n");
 }
 void sftpHost::sftp_put_one(char *src, char *dst)
 {
 	print("put %s\t\t\t", dst);
-	LIBSSH2_SFTP_HANDLE *sftp_handle = libssh2_sftp_open(sftp_session, dst,
+	LIBSSH2_SFTP_HANDLE *sftp_handle;
+	SSH_OPEN(ssh, sftp_handle, libssh2_sftp_open(sftp_session, dst,
 					  LIBSSH2_FXF_WRITE|LIBSSH2_FXF_CREAT|LIBSSH2_FXF_TRUNC,
 					  LIBSSH2_SFTP_S_IRUSR|LIBSSH2_SFTP_S_IWUSR|
-					  LIBSSH2_SFTP_S_IRGRP|LIBSSH2_SFTP_S_IROTH);
+					  LIBSSH2_SFTP_S_IRGRP|LIBSSH2_SFTP_S_IROTH));
 	if (!sftp_handle) {
 		print("\033[31mcouldn't open remote file\r\n");
 		return;
@@ -1236,7 +1846,8 @@ void sftpHost::sftp_put_one(char *src, char *dst)
 	FILE *fp = fopen(src, "rb");
 	if ( fp==NULL ) {
 		print("\033[31mcouldn't open local file\r\n");
-		libssh2_sftp_close(sftp_handle);
+		int rc;
+		SSH_TRY(ssh, rc, libssh2_sftp_close(sftp_handle));
 		return;
 	}
 
@@ -1244,13 +1855,16 @@ void sftpHost::sftp_put_one(char *src, char *dst)
 	long total=0;
 	char mem[1024*32];
 	time_t start = time(NULL);
+	double t0 = metric_clock();
 	while ( (nread=fread(mem, 1, 1024*32, fp))>0 ) {
 		int rc=0;
 		for ( int nwrite=0; nwrite<nread && rc>=0; ) {
-			rc=libssh2_sftp_write(sftp_handle, mem+nwrite, nread-nwrite);
+			SSH_TRY(ssh, rc, libssh2_sftp_write(sftp_handle, mem+nwrite,
+															nread-nwrite));
 			if ( rc>0 ) {
 				nwrite += rc;
 				total += rc;
+				metric_add(app_metrics().xfer_bytes[XFER_SFTP_PUT], rc);
 			}
 		}
 		if ( rc>0 ) {
@@ -1265,7 +1879,9 @@ void sftpHost::sftp_put_one(char *src, char *dst)
 		}
 	}
 	fclose(fp);
-	libssh2_sftp_close(sftp_handle);
+	int rc;
+	SSH_TRY(ssh, rc, libssh2_sftp_close(sftp_handle));
+	metric_xfer_done(XFER_SFTP_PUT, t0);
 	if ( nread==0 ) print_total(start, total);
 	print("\r\n");
 }
@@ -1291,21 +1907,25 @@ void sftpHost::sftp_get(char *src, char *dst)
 	else {
 		char *pattern = strrchr(src, '/');
 		if ( pattern!=NULL ) *pattern++ = 0;
-		if ( (sftp_handle=libssh2_sftp_opendir(sftp_session, src))!=NULL ) {
+		SSH_OPEN(ssh, sftp_handle, libssh2_sftp_opendir(sftp_session, src));
+		if ( sftp_handle!=NULL ) {
 			char rfile[1024], lfile[1024];
 			strcpy(rfile, src); strcat(rfile, "/");
 			int rlen = strlen(rfile);
 			strcpy(lfile, dst); if ( *lfile ) strcat(lfile, "/");
 			int llen = strlen(lfile);
-			while ( libssh2_sftp_readdir(sftp_handle, mem,
-									sizeof(mem), &attrs)>0 ) {
+			int rc;
+			while ( true ) {
+				SSH_TRY(ssh, rc, libssh2_sftp_readdir(sftp_handle, mem,
+												sizeof(mem), &attrs));
+				if ( rc<=0 ) break;
 				if ( fnmatch(pattern, mem, 0)==0 ) {
 					strcpy(rfile+rlen, mem);
 					strcpy(lfile+llen, mem);
 					sftp_get_one(rfile, lfile);
 				}
 			}
-			libssh2_sftp_closedir(sftp_handle);
+			SSH_TRY(ssh, rc, libssh2_sftp_closedir(sftp_handle));
 		}
 		else {
 			print("\033[31mcould't open remote dir \033[32m%s\r\n", src);
@@ -1321,7 +1941,9 @@ void sftpHost::sftp_put(char *src, char *dst)
 		char rfile[1024] = ".";
 		if ( *dst ) strcpy(rfile, dst);
 		LIBSSH2_SFTP_ATTRIBUTES attrs;
-		if ( libssh2_sftp_stat(sftp_session, rfile, &attrs)==0 ) {
+		int rc;
+		SSH_TRY(ssh, rc, libssh2_sftp_stat(sftp_session, rfile, &attrs));
+		if ( rc==0 ) {
 			if ( LIBSSH2_SFTP_S_ISDIR(attrs.permissions) ) {
 				char *p = strrchr(src, '/');
 				if ( p!=NULL ) p++; else p=src;
@@ -1438,6 +2060,12 @@ int sftpHost::sftp(char *cmd)
 int sftpHost::read()
 {
 	status(HOST_CONNECTING);
+	ssh = sshHost::pool_get(options);	//busy counted for this till drop()
+	if ( ssh!=NULL ) {
+		if ( ssh->borrow(this) ) goto Sftp_Init;
+		goto Sftp_Close;
+	}
+	ssh = this;
 	if ( tcp()==-1 ) goto TCP_Close;
 
 	channel = NULL;
@@ -1462,39 +2090,59 @@ int sftpHost::read()
 		term_puts(errmsgs[4], -4);
 		goto Sftp_Close;
 	}
-	if ( !(sftp_session=libssh2_sftp_init(session)) ) {
+
+Sftp_Init:
+	SSH_OPEN(ssh, sftp_session, libssh2_sftp_init(ssh->session));
+	if ( sftp_session==NULL ) {
 		term_puts(errmsgs[6], -6);
 		goto Sftp_Close;
 	}
-	if ( libssh2_sftp_realpath(sftp_session, ".", realpath, 1024)<0 )
-		*realpath=0;
+	SSH_TRY(ssh, rc, libssh2_sftp_realpath(sftp_session, ".", realpath, 1024));
+	if ( rc<0 ) *realpath=0;
 	strcpy(homepath, realpath);
 
 	status(HOST_CONNECTED);
 	term_puts("Connected", 0);
 	bRunning = true;
 	while ( bRunning ) {
-		const char *cmd = term_gets("\033[32msftp> \033[37m", true);
-		for ( int i=0; i<10 && cmd==NULL && bRunning; i++ )
-			cmd=term_gets("", true);
-		if ( cmd!=NULL ) {
-			mtx.lock();
-			int rc = sftp((char *)cmd);
-			mtx.unlock();
-			if ( rc==-1 ) break;
-		}
-		else { 
+		term_ask("\033[32msftp> \033[37m", true);
+		std::unique_lock<std::mutex> lck(cmds_mtx);
+		if ( !cmds_cv.wait_for(lck, std::chrono::minutes(10),
+					[this]{ return !bRunning || !cmds.empty(); }) ) {
 			term_puts("TimeOut!", 8);
 			break;
-		} 
+		}
+		if ( !bRunning ) break;
+		char *cmd = cmds.front();
+		cmds.pop_front();
+		lck.unlock();
+
+		sftp_mtx.lock();
+		rc = sftp(cmd);
+		sftp_mtx.unlock();
+		free(cmd);
+		if ( rc==-1 ) break;
+	}
+	cmds_mtx.lock();
+	while ( !cmds.empty() ) {
+		free(cmds.front());
+		cmds.pop_front();
 	}
-	libssh2_sftp_shutdown(sftp_session);
+	cmds_mtx.unlock();
+	SSH_TRY(ssh, rc, libssh2_sftp_shutdown(sftp_session));
 	term_puts("Disonnected", -1);
 
 	*username = 0;
 	*password = 0;
 
 Sftp_Close:
+	if ( ssh!=this ) {				//pooled session stays for others
+		ssh->drop();
+		ssh = this;
+		status(HOST_IDLE);
+		reader.detach();
+		return 0;
+	}
 	if ( session!=NULL ) {
 		libssh2_session_disconnect(session, "Normal Shutdown");
 		libssh2_session_free(session);
@@ -1515,11 +2163,20 @@ int sftpHost::write(const char *buf, int len)
 void sftpHost::send_file(char *src, char *dst)
 {
 	for ( char *p=src; *p; p++ ) if ( *p=='\\' && p[1]!=' ' ) *p='/';
-	mtx.lock();
+	if ( status()!=HOST_CONNECTED ) return;
+	sftp_mtx.lock();
 	sftp_put(src, realpath);
-	mtx.unlock();
+	sftp_mtx.unlock();
+}
+void sftpHost::answer(const char *line)	//called from UI thread on return
+{
+	std::lock_guard<std::mutex> lck(cmds_mtx);
+	cmds.push_back(strdup(line));
+	cmds_cv.notify_one();
 }
 void sftpHost::disconn()
 {
+	std::lock_guard<std::mutex> lck(cmds_mtx);
 	bRunning = false;
+	cmds_cv.notify_one();
 }
@@ -22,7 +22,9 @@
 #include <libssh2_sftp.h>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include <list>
+#include <string>
 
 #ifndef _SSH2_H_
 #define _SSH2_H_
@@ -34,9 +36,15 @@ struct TUNNEL
 	unsigned short localport;
 	unsigned short remoteport;
 	LIBSSH2_CHANNEL *channel;
+	std::string to_chan;	//read from socket, channel not taking it yet
+	std::string to_sock;	//read from channel, socket not taking it yet
+	bool eof;				//one end is done, closed once the rest is sent
 };
 
+class sshChannel;
 class sshHost : public tcpHost {
+	friend class sshChannel;
+	friend class sftpHost;
 protected:
 	char username[64];
 	char password[64];
@@ -47,10 +55,26 @@ protected:
 	LIBSSH2_SESSION *session;
 	LIBSSH2_CHANNEL *channel;
 	std::mutex mtx;			//to protect ssh session access
+	std::atomic<int> wake_s;//loopback udp socket to wake up the reactor
+	std::atomic<bool> wake_pending;
+	std::thread::id reader_id;//reactor thread calling readable()
 	std::mutex tunnel_mtx;	//to protect tunnel_list access
 	std::list<TUNNEL *> tunnel_list;
+	std::mutex chan_mtx;	//to protect channels
+	std::list<sshChannel *> channels;//duplicated shells, read by readable()
+	std::list<LIBSSH2_CHANNEL *> closing;//closed, free till not EAGAIN
+	std::condition_variable chan_cv;//notified when connected or failed
+
+	int pooled;				//0 owned by a tab, 1 in the session pool, 2 retired
+	bool orphan;			//detached while busy, drop() frees the session
+	HOST *console;			//borrower shown output of a pooled session
+	std::mutex console_mtx;	//to protect console
+	std::mutex cmd_mtx;		//one scp or tun at a time from borrowers
 
 	int wait_socket();
+	int wait_output();		//reactor to wake readable() when sock is writable
+	void wake();
+	void ssh_unlock();		//mtx.unlock(), wakes readable() if not called by it
 	int ssh_knownhost();
 	int ssh_authentication();
 	void write_keys(const char *buf, int len);
@@ -66,13 +90,32 @@ protected:
 							char *remoteip, unsigned short remoteport);
 	void tun_del(int tun_sock);
 	void tun_closeall();
-	void tun_worker(int forwardsock, LIBSSH2_CHANNEL *tun_channel);
+	void tun_close(int tun_sock, LIBSSH2_CHANNEL *tun_channel);
+	bool tun_flush(TUNNEL *tun);
+	void tun_send(int tun_sock);
+	void tun_recv();
 	int tun_local(char *parameters);
 	int tun_remote(char *parameters);
 	void tun(const char *cmd);
+	bool chan_add(sshChannel *dup);
+	void chan_recv();
+	void drop();			//busy--, after a borrower is done with session
+	void session_close();
+
+	static sshHost *pool_get(const char *name);
+	bool borrow(HOST *borrower);
+	bool in_use();
+	bool has_readers();		//anything read by readable(), besides borrowers
+	void pool_remove();
+	void console_set(HOST *borrower);
+	static void pool_puts(void *data, const char *buf, int len);
+	static char *pool_gets(void *data, const char *prompt, bool echo);
+	static void pool_ask(void *data, const char *prompt, bool echo);
+	static void pool_reaper();
 
 public:
 	sshHost(const char *name);
+	~sshHost();
 
 //	virtual const char *name();
 //	virtual void connect();
@@ -80,18 +123,57 @@ public:
 	virtual	int read();
 	virtual int write(const char *buf, int len);
 	virtual void disconn();
+	virtual int readable(int fd);
+	virtual void detached();
 	virtual void command(const char *cmd);
 	virtual void send_file(char *src, char *dst);
 	virtual void send_size(int sx, int sy);
+	virtual HOST *dup();
 	void keepalive(int interval);
+	static HOST *pool_borrow(const char *name);	//NULL if not pooled
+};
+extern int ssh_pool_idle;	//seconds an unused pooled session is kept, 0 to
+							//not pool sessions at all
+
+class sshChannel : public HOST {	//another shell on the session of an sshHost
+	friend class sshHost;
+private:
+	char hostname[128];
+	char options[256];			//to get a pooled session again at reconnect
+	sshHost *master;			//owner of the session, NULL once it's gone
+	std::mutex master_mtx;		//to protect master
+	LIBSSH2_CHANNEL *channel;
+	bool reserved;				//counted in master->busy till read() is done
+	void release();
+	sshHost *hold();			//master with busy counted, drop() after use
+
+public:
+	sshChannel(sshHost *ssh, const char *name="");
+	~sshChannel();
+	virtual const char *name() { return hostname; }
+	virtual int type() { return HOST_SSH; }
+	virtual int read();			//opens the channel, then master reads for it
+	virtual int write(const char *buf, int len);
+	virtual void disconn();
+	virtual void send_size(int sx, int sy);
+	virtual void detached();
+	virtual void command(const char *cmd);
+	virtual void send_file(char *src, char *dst);
+	virtual HOST *dup();
 };
 
 class sftpHost : public sshHost {
 private:
+	char options[256];				//to get a pooled session
+	sshHost *ssh;					//owner of the session, this if not pooled
+	std::mutex sftp_mtx;			//one command at a time on sftp_session
 	LIBSSH2_SFTP *sftp_session;
 	char realpath[MAX_PATH];
 	char homepath[MAX_PATH];
 	std::atomic<bool> bRunning;
+	std::list<char *> cmds;			//commands from answer(), run by read()
+	std::mutex cmds_mtx;
+	std::condition_variable cmds_cv;
 
 protected:
 	void sftp_lcd(char *path);
@@ -107,7 +189,12 @@ protected:
 	void sftp_put(char *src, char *dst);
 
 public:
-	sftpHost(const char *name) : sshHost(name) {}
+	sftpHost(const char *name) : sshHost(name)
+	{
+		strncpy(options, name, 255);
+		options[255] = 0;
+		ssh = this;
+	}
 //	virtual const char *name();
 //	virtual void connect();					//from sshHost
 	virtual int type() { return HOST_SFTP; }
@@ -115,6 +202,7 @@ public:
 	virtual int write(const char *buf, int len);
 	virtual void disconn();
 	virtual void send_file(char *src, char *dst);
+	virtual void answer(const char *line);
 	int sftp(char *p);
 };
 #endif //_SSH2_H_
\ No newline at end of file
@@ -31,6 +31,9 @@ const char ABOUT_TERM2[]="\r\n\n\
 const char FLTERM[]="\r\033[32mFLTerm > \033[37m";
 
 #include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
 #include "host.h"
 #include "ssh2.h"
 #include "Fl_Term.h"
@@ -45,6 +48,7 @@ const char FLTERM[]="\r\033[32mFLTerm > \033[37m";
 #include <FL/Fl_Input.H>
 #include <FL/Fl_Input_Choice.H>
 #include <FL/Fl_Hold_Browser.H>
+#include <FL/Fl_Check_Browser.H>
 #include <FL/Fl_Sys_Menu_Bar.H>
 #include <FL/Fl_Double_Window.H>
 #include <FL/Fl_Native_File_Chooser.H>
@@ -119,7 +123,7 @@ void about_cb(Fl_Widget *w, void *data)
 }
 const char *kb_gets(unsigned char *prompt, int echo)
 {
-	if ( !pTerm->live() ) return NULL;
+	if ( pTerm==NULL || !pTerm->live() ) return NULL;
 	return pTerm->gets((const char *)prompt, echo);
 }
 void resize_window(int cols, int rows)
@@ -216,7 +220,8 @@ HOST *host_new(const char *hostname)
 {
 	HOST *host=NULL;
 	if ( strncmp(hostname, "ssh " , 4)==0 ) {
-		host = new sshHost(hostname+4);
+		host = sshHost::pool_borrow(hostname+4);
+		if ( host==NULL ) host = new sshHost(hostname+4);
 	}
 	else if ( strncmp(hostname, "sftp ", 5)==0 ) {
 		host = new sftpHost(hostname+5);
@@ -249,7 +254,19 @@ void term_connect(const char *hostname)
 		pTerm->copy_label(label);
 	}
 }
-bool tab_match(int i, char *label)
+bool term_dup(Fl_Term *t)
+{//new tab with another shell on the ssh session of t, no login again
+	HOST *host = t->dup_host();
+	if ( host==NULL ) return false;
+	tab_new();
+	pTerm->connect(host, NULL);
+	char label[64];
+	strcpy(label, pTerm->label());
+	strcat(label, " @-31+");
+	pTerm->copy_label(label);
+	return true;
+}
+bool tab_match(int i, const char *label)
 {
 	Fl_Term *t = (Fl_Term *)pTabs->child(i);
 	if ( strncmp(t->label(), label, strlen(label))==0 ) {
@@ -258,7 +275,7 @@ bool tab_match(int i, char *label)
 	}
 	return false;
 }
-int term_command(char *cmd, const char **preply)
+int term_command(Fl_Term *t, const char *cmd, REPLY *reply)
 {
 	int rc = 0;
 	if ( strncmp(cmd, "!Tab", 4)==0 ) {
@@ -273,13 +290,23 @@ int term_command(char *cmd, const char **preply)
 		}
 		else
 			tab_new();
-		if ( preply!=NULL ) {
-			*preply = pTerm->label();
-			rc = strlen(*preply);
+		if ( reply!=NULL ) {
+			rc = strlen(pTerm->label());
+			reply->copy(pTerm->label(), rc);
 		}
 	}
+	else if ( strncmp(cmd, "!Duplicate", 10)==0 ) {
+		if ( term_dup(t) ) {
+			if ( reply!=NULL ) {
+				rc = strlen(pTerm->label());
+				reply->copy(pTerm->label(), rc);
+			}
+		}
+		else
+			rc = -1;
+	}
 	else {
-		rc = pTerm->command(cmd, preply);
+		rc = t->command(cmd, reply);
 	}
 	return rc;
 }
@@ -570,6 +597,288 @@ void pause_cb(Fl_Widget *w, void *data)
 	pMenuBar->replace(pMenuBar->find_index("Script/Quit")+1,
 					pTerm->pause_script()?"Resume":"Pause");
 }
+/*******************************************************************************
+* run script on tabs, one worker thread per tab                                *
+*******************************************************************************/
+struct TAB_JOB {
+	Fl_Term *term;
+	char label[64];
+	SCRIPT *script;				//compiled once, shared by all workers
+	int total;					//number of ops in script
+	std::atomic<int> done;		//commands finished
+	std::atomic<int> failures;	//timed out or error pattern in reply
+	std::atomic<bool> finished;
+	double secs;
+	std::string result;			//commands and replies, read after finished
+	std::vector<std::pair<long, std::string>> pending;//pipelined, no reply yet
+};
+static std::vector<TAB_JOB *> tab_jobs;
+static std::vector<Fl_Term *> tab_terms;	//terms listed in pTabList
+static char tab_script[4096];
+static SCRIPT tab_compiled;
+Fl_Window *pTabsDlg;
+Fl_Check_Browser *pTabList;
+Fl_Browser *pProgress;
+Fl_Button *pTabsRun;
+
+static void tab_result(TAB_JOB *job, const char *cmd, REPLY &reply, int len,
+											bool timed_out, bool error)
+{
+	job->result += "> ";
+	job->result += cmd;
+	job->result += "\n";
+	if ( *cmd!='!' ) {
+		if ( reply.data!=NULL && len>0 ) {
+			job->result.append(reply.data, len);
+			job->result += "\n";
+		}
+		if ( timed_out || error ) {
+			job->result += timed_out ? "*** timed out\n" : "*** error\n";
+			job->failures++;
+		}
+	}
+	job->done++;
+}
+static void tab_replies(TAB_JOB *job, bool all)
+{//results of pipelined commands in order, all=false stops at the first one
+ //still waiting for its prompt, all=true after the pipeline is drained
+	size_t i;
+	for ( i=0; i<job->pending.size(); i++ ) {
+		REPLY reply;
+		bool error = false, timed_out = true;
+		int len = job->term->block_reply(job->pending[i].first, &reply,
+											&error, &timed_out);
+		if ( timed_out && !all ) break;
+		if ( len==-1 ) {			//trimmed before it was read
+			len = 0;
+			reply.data = NULL;
+		}
+		tab_result(job, job->pending[i].second.c_str(), reply, len,
+											timed_out, error);
+	}
+	job->pending.erase(job->pending.begin(), job->pending.begin()+i);
+}
+static bool tab_exec(void *data, const char *cmd)
+{//script_exec for tab and batch jobs, keeps the result of each command
+	TAB_JOB *job = (TAB_JOB *)data;
+	Fl_Term *t = job->term;
+	if ( *cmd!='!' && !t->live() ) {
+		t->exec_wait();
+		tab_replies(job, true);
+		job->result += "*** not connected\n";
+		job->failures++;
+		return false;
+	}
+	if ( *cmd!='!' && t->pipelining() ) {
+		if ( !t->exec(cmd) ) {		//not sent, pipeline timed out
+			tab_replies(job, true);
+			REPLY reply;
+			tab_result(job, cmd, reply, 0, true, false);
+			return false;
+		}
+		job->pending.push_back(std::make_pair(t->last_block(),
+											  std::string(cmd)));
+		tab_replies(job, false);
+		return true;
+	}
+	t->exec_wait();
+	tab_replies(job, true);
+	REPLY reply;
+	int len = t->command(cmd, &reply);
+	tab_result(job, cmd, reply, len, t->timed_out(), t->reply_error());
+	return true;
+}
+void tab_worker(TAB_JOB *job)
+{
+	auto start = std::chrono::steady_clock::now();
+	if ( !job->term->run(job->script, tab_exec, job) ) {
+		job->result += "*** another script is running\n";
+		job->failures++;
+	}
+	tab_replies(job, true);
+	job->secs = std::chrono::duration<double>(
+					std::chrono::steady_clock::now()-start).count();
+	job->finished = true;
+	if ( pTerm!=NULL ) Fl::awake();
+}
+void tabs_save()		//write combined result file when all jobs finished
+{
+	char fn[4200], line[256];
+	snprintf(fn, 4200, "%s.results.txt", tab_script);
+	FILE *fp = fl_fopen(fn, "w");
+	if ( fp!=NULL ) {
+		for ( TAB_JOB *job : tab_jobs ) {
+			fprintf(fp, "===== %s: %d/%d lines, %d failures, %.1f seconds "
+						"=====\n", job->label, (int)job->done, job->total,
+						(int)job->failures, job->secs);
+			fwrite(job->result.c_str(), 1, job->result.size(), fp);
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+		snprintf(line, 256, "@iresults saved to %s", fl_filename_name(fn));
+	}
+	else
+		snprintf(line, 256, "@icouldn't write %s", fl_filename_name(fn));
+	pProgress->add(line);
+	for ( TAB_JOB *job : tab_jobs ) delete job;
+	tab_jobs.clear();
+	pTabsRun->activate();
+}
+void tabs_progress(void *)	//refresh progress table until all jobs finish
+{
+	int finished = 0;
+	char line[256];
+	pProgress->clear();
+	pProgress->add("@bTab\t@bStatus\t@bLines\t@bFailures");
+	for ( TAB_JOB *job : tab_jobs ) {
+		const char *status = "running";
+		if ( job->finished ) {
+			finished++;
+			status = job->failures>0 ? "@C1failed" : "@C2done";
+		}
+		snprintf(line, 256, "%s\t%s\t%d/%d\t%d", job->label, status,
+					(int)job->done, job->total, (int)job->failures);
+		pProgress->add(line);
+	}
+	if ( finished==(int)tab_jobs.size() )
+		tabs_save();
+	else
+		Fl::repeat_timeout(0.5, tabs_progress);
+}
+void tabs_run_cb(Fl_Widget *w)
+{
+	FILE *fp = fl_fopen(tab_script, "rb");
+	if ( fp==NULL ) {
+		fl_alert("couldn't open %s", tab_script);
+		return;
+	}
+	std::string script;
+	char buf[4096];
+	int len;
+	while ( (len=fread(buf, 1, 4096, fp))>0 ) script.append(buf, len);
+	fclose(fp);
+	int total = tab_compiled.compile(script.c_str());
+
+	for ( int i=1; i<=pTabList->nitems(); i++ ) {
+		if ( !pTabList->checked(i) ) continue;
+		TAB_JOB *job = new TAB_JOB;
+		job->term = tab_terms[i-1];
+		strncpy(job->label, pTabList->text(i), 63);
+		job->label[63] = 0;
+		job->script = &tab_compiled;
+		job->total = total==-1 ? 0 : total;
+		job->done = job->failures = 0;
+		job->finished = total==-1;
+		job->secs = 0;
+		if ( total==-1 ) {			//every tab fails on a script error
+			job->result = "*** script error, ";
+			job->result += tab_compiled.error();
+			job->result += "\n";
+			job->failures++;
+		}
+		tab_jobs.push_back(job);
+	}
+	if ( tab_jobs.empty() ) return;
+	pTabsRun->deactivate();
+	if ( total!=-1 ) for ( TAB_JOB *job : tab_jobs ) {
+		std::thread workerThread(tab_worker, job);
+		workerThread.detach();
+	}
+	Fl::add_timeout(0.5, tabs_progress);
+}
+void tabs_dlg_build()
+{
+	pTabsDlg = new Fl_Window(480, 480, "Run script on tabs");
+	{
+		pTabList = new Fl_Check_Browser(20, 20, 440, 160);
+		pProgress = new Fl_Browser(20, 200, 440, 220);
+		pTabsRun = new Fl_Button(280, 440, 80, 24, "Run");
+		Fl_Button *pClose = new Fl_Button(120, 440, 80, 24, "Close");
+		static int widths[] = { 200, 80, 80, 0 };
+		pProgress->column_widths(widths);
+		pProgress->column_char('\t');
+		pTabList->textsize(16);
+		pProgress->textsize(16);
+		pTabsRun->labelsize(16);
+		pClose->labelsize(16);
+		pTabsRun->callback(tabs_run_cb);
+		pClose->callback(cancel_cb);
+	}
+	pTabsDlg->end();
+}
+void tabs_cb(Fl_Widget *w, void *data)
+{
+	if ( !tab_jobs.empty() ) {
+		pTabsDlg->show();
+		return;
+	}
+	const char *fname = file_chooser("script:", "All\t*.*", OPEN_FILE);
+	if ( fname==NULL ) return;
+	strncpy(tab_script, fname, 4095);
+	tab_script[4095] = 0;
+
+	char label[64], title[4200];
+	pTabList->clear();
+	tab_terms.clear();
+	int n = pTabs==NULL ? 1 : pTabs->children();
+	for ( int i=0; i<n; i++ ) {
+		Fl_Term *t = pTabs==NULL ? pTerm : (Fl_Term *)pTabs->child(i);
+		strncpy(label, t->label(), 63);
+		label[63] = 0;
+		char *p = strstr(label, " @-31+");
+		if ( p!=NULL ) *p = 0;
+		pTabList->add(label, t->live());
+		tab_terms.push_back(t);
+	}
+	pProgress->clear();
+	snprintf(title, 4200, "Run %s on tabs", fl_filename_name(tab_script));
+	pTabsDlg->copy_label(title);
+	pTabsDlg->resize(pWindow->x()+100, pWindow->y()+100, 480, 480);
+	pTabsDlg->show();
+}
+/*******************************************************************************
+* command history dialog, jump to the reply of a command                      *
+*******************************************************************************/
+Fl_Window *pHistDlg;
+Fl_Hold_Browser *pHistList;
+static Fl_Term *hist_term;			//term listed in pHistList
+void hist_select_cb(Fl_Widget *w, void *data)
+{
+	int i = pHistList->value();
+	if ( pTabs!=NULL && pTabs->find(hist_term)==pTabs->children() ) return;
+	if ( i>0 ) hist_term->jump_block(atoi(pHistList->text(i)));
+}
+void hist_dlg_build()
+{
+	pHistDlg = new Fl_Window(480, 400, "Command history");
+	{
+		pHistList = new Fl_Hold_Browser(0, 0, 480, 400);
+		static int widths[] = { 50, 70, 0 };
+		pHistList->column_widths(widths);
+		pHistList->column_char('\t');
+		pHistList->textsize(16);
+		pHistList->callback(hist_select_cb);
+	}
+	pHistDlg->resizable(pHistList);
+	pHistDlg->end();
+}
+void hist_cb(Fl_Widget *w, void *data)
+{
+	REPLY reply;
+	hist_term = pTerm;
+	pHistList->clear();
+	int len = pTerm->history("", &reply);
+	std::string list(reply.data==NULL ? "" : reply.data, len);
+	for ( size_t p0=0, p1; p0<list.size(); p0=p1+1 ) {
+		p1 = list.find('\n', p0);
+		if ( p1==std::string::npos ) p1 = list.size();
+		pHistList->add(list.substr(p0, p1-p0).c_str());
+	}
+	pHistList->bottomline(pHistList->size());
+	pHistDlg->resize(pWindow->x()+100, pWindow->y()+100, 480, 400);
+	pHistDlg->show();
+}
+
 /*******************************************************************************
 * command editor functions                                                     *
 *******************************************************************************/
@@ -585,6 +894,7 @@ void cmd_send(Fl_Term *t, const char *cmd)
 	}
 	else {
 		if ( t->live() ) {
+			t->mark_command(cmd);
 			t->send(cmd);
 			t->send("\r");
 		}
@@ -662,15 +972,29 @@ void logg_cb(Fl_Widget *w, void *data)
 	}
 	pTerm->logg(fname);
 }
+void record_cb(Fl_Widget *w, void *data)
+{
+	const char *fname = NULL;
+	if ( !pTerm->recording() ) {
+		fname = file_chooser("record session to file:",
+							"Recording\t*.rec", SAVE_FILE);
+		if ( fname==NULL ) return;
+	}
+	pTerm->record(fname);
+}
 void menu_cb(Fl_Widget *w, void *data)
 {
 	const char *menutext = pMenuBar->text();
 	if ( strcmp(menutext, "&Disconnect")==0 ) {
 		pTerm->disconn();
 	}
+	else if ( strcmp(menutext, "D&uplicate")==0 ) {
+		if ( !term_dup(pTerm) )
+			fl_alert("Duplicate needs a connected ssh session");
+	}
 	else if ( strcmp(menutext, "Save...")==0 ) {
 		const char *fname = file_chooser("save buffer to file:", 
-										 "Text\t*.txt", SAVE_FILE);
+							"Text\t*.txt\nHTML\t*.html\nANSI\t*.ans", SAVE_FILE);
 		if ( fname!=NULL ) pTerm->save(fname);
 	}
 	else if ( strcmp(menutext, "Search...")==0 ) {
@@ -729,12 +1053,16 @@ Fl_Menu_Item menubar[] = {
 {"Term",	 	0,			0,		0,	FL_SUBMENU},
 {"&Connect...", FL_CMD+'c',	connect_dlg},
 {"&Disconnect", FL_CMD+'d',	menu_cb},
+{"D&uplicate",	FL_CMD+'u',	menu_cb},
 {"Log...",		0,			logg_cb},
+{"Record...",	0,			record_cb},
 {"Save...",		0,			menu_cb},
-{"Search...",	0,			menu_cb,0,	FL_MENU_DIVIDER},
+{"Search...",	0,			menu_cb},
+{"&History...",	FL_CMD+'h',	hist_cb,0,	FL_MENU_DIVIDER},
 {0},
 {"Script",		0,			0,		0,	FL_SUBMENU},
 {"&Run...",		FL_CMD+'r',	run_cb},
+{"Run on &Tabs...",0,		tabs_cb},
 {"Quit",		0,			quit_cb},
 {"Pause",		0,			pause_cb,0,	FL_MENU_DIVIDER},
 {0},
@@ -790,6 +1118,9 @@ void load_dict()
 				else if ( strncmp(line+1, "TermSize ", 9)==0 ) {
 					sscanf(line+10, "%dx%d", &termcols, &termrows);
 				}
+				else if ( strncmp(line+1, "SshPool ", 8)==0 ) {
+					ssh_pool_idle = atoi(line+9);
+				}
 				else if ( strncmp(line+1, "WindowOpacity", 12)==0 ) {
 					opacity = atof(line+14);
 					Fl_Menu_Item * pItem = (Fl_Menu_Item *)
@@ -838,6 +1169,7 @@ void save_dict()
 		fprintf(fp, "~FontFace %s\n", Fl::get_font_name(fontnum, &t));
 		fprintf(fp, "~FontSize %d\n", fontsize);
 		if ( local_edit ) fprintf(fp, "~LocalEdit\n");
+		if ( ssh_pool_idle!=60 ) fprintf(fp, "~SshPool %d\n", ssh_pool_idle);
 		if ( opacity!=1.0 ) 
 			fprintf(fp, "~WindowOpacity %.3f\n", opacity);
 
@@ -876,8 +1208,160 @@ void title_cb(void *)
 
 	Fl::repeat_timeout(1.0, title_cb);
 }
+int replay_bench(const char *fn)	//headless replay at maximum speed
+{
+	Fl_Term term(80, 25);
+	long bytes;
+	double secs;
+	int frames = term.replay(fn, 0, &bytes, &secs);
+	if ( frames<0 ) {
+		fprintf(stderr, "couldn't replay %s\n", fn);
+		return 1;
+	}
+	if ( secs<=0 ) secs = 1e-6;
+	printf("%s: %d frames, %ld bytes in %.3fs, %.2fMB/s, %.0f frames/s\n",
+			fn, frames, bytes, secs, bytes/secs/1048576, frames/secs);
+	return 0;
+}
+static bool batch_setting(const char *line)
+{//'!' lines at the beginning of a batch script that run before connecting
+	const char *ctls[] = { "!If ", "!Else", "!Loop", "!Break", "!End",
+							"!Include " };
+	if ( *line!='!' ) return false;
+	for ( const char *ctl : ctls )
+		if ( strncmp(line, ctl, strlen(ctl))==0 ) return false;
+	return true;
+}
+void batch_host(int n, const char *conn, SCRIPT *pre, SCRIPT *script,
+																int total)
+{//connect headless term to host n, run script, save replies to hostname-n.txt,
+ //n keeps replies apart when a host is listed more than once
+	auto start = std::chrono::steady_clock::now();
+	Fl_Term *term = new Fl_Term(80, 25);
+	TAB_JOB job;
+	job.term = term;
+	job.script = script;
+	job.total = total;
+	job.done = job.failures = 0;
+	job.finished = false;
+	job.secs = 0;
+
+	if ( pre!=NULL )			//settings like !Prompt or !Set at the beginning
+		term->run(pre, tab_exec, &job);	//of script apply before connecting
+	REPLY reply;
+	char cmd[1024];				//connect line is not saved to the output,
+	snprintf(cmd, 1024, "!%s", conn);	//as it may have -pw password in it
+	term->command(cmd, &reply);
+	if ( term->timed_out() ) term->learn_prompt();
+	strncpy(job.label, term->hostname(), 63);
+	job.label[63] = 0;
+	if ( !term->live() ) {
+		job.result += "*** couldn't connect\n";
+		job.failures++;
+	}
+	else if ( script!=NULL )
+		tab_worker(&job);
+	if ( term->live() ) term->disconn();
+	for ( int i=0; i<100 && term->live(); i++ )
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	while ( term->live() ) {	//no goodbye in 10 seconds, hang up on it,
+		term->hangup();			//the reader quits on the failed read
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	delete term;
+	double secs = std::chrono::duration<double>(
+					std::chrono::steady_clock::now()-start).count();
+
+	char fn[256];
+	for ( char *p=job.label; *p; p++ )
+		if ( !isalnum(*p) && *p!='.' && *p!='-' ) *p = '_';
+	snprintf(fn, 256, "%s-%d.txt", *job.label ? job.label : "unknown", n);
+	FILE *fp = fopen(fn, "w");
+	if ( fp!=NULL ) {
+		fwrite(job.result.c_str(), 1, job.result.size(), fp);
+		fclose(fp);
+	}
+	printf("%s: %s, %d/%d lines, %d failures, %.1f seconds\n", fn,
+			job.failures>0 ? "failed" : "ok", (int)job.done, job.total,
+			(int)job.failures, secs);
+	fflush(stdout);
+}
+int batch_run(const char *hostfile, const char *scriptfile, int parallel)
+{//run script on every host in hostfile, with at most parallel connections
+	std::vector<std::string> hosts;
+	std::string script;
+	char line[1024];
+	FILE *fp = fopen(hostfile, "r");
+	if ( fp==NULL ) {
+		fprintf(stderr, "couldn't open %s\n", hostfile);
+		return 1;
+	}
+	while ( fgets(line, 1024, fp)!=NULL ) {
+		line[strcspn(line, "\r\n")] = 0;
+		if ( *line && *line!='#' ) hosts.push_back(line);
+	}
+	fclose(fp);
+	fp = fopen(scriptfile, "r");
+	if ( fp==NULL ) {
+		fprintf(stderr, "couldn't open %s\n", scriptfile);
+		return 1;
+	}
+	while ( fgets(line, 1024, fp)!=NULL ) script += line;
+	fclose(fp);
+	while ( !script.empty() && (script.back()=='\n'||script.back()=='\r') )
+		script.pop_back();
+	SCRIPT compiled;			//checked as a whole for the line numbers
+	int total = compiled.compile(script.c_str());
+	if ( total==-1 ) {
+		fprintf(stderr, "%s: %s\n", scriptfile, compiled.error());
+		return 1;
+	}
+	size_t body = 0;			//leading settings lines run before connect
+	while ( body<script.size() && batch_setting(script.c_str()+body) ) {
+		body = script.find('\n', body);
+		body = body==std::string::npos ? script.size() : body+1;
+	}
+	SCRIPT setup;
+	if ( body>0 && setup.compile(script.substr(0, body).c_str())==-1 ) {
+		fprintf(stderr, "%s: %s\n", scriptfile, setup.error());
+		return 1;
+	}
+	if ( body<script.size() && compiled.compile(script.c_str()+body)==-1 ) {
+		fprintf(stderr, "%s: %s\n", scriptfile, compiled.error());
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	ssh_pool_idle = 0;			//a session per host, none left behind for
+	libssh2_init(0);			//libssh2_exit() or the pool reaper
+	std::atomic<int> next(0);
+	std::vector<std::thread> pool;
+	if ( parallel<1 ) parallel = 1;
+	for ( int i=0; i<parallel && i<(int)hosts.size(); i++ )
+		pool.push_back(std::thread([&]() {
+			int n;
+			while ( (n=next++)<(int)hosts.size() )
+				batch_host(n+1, hosts[n].c_str(), body>0 ? &setup : NULL,
+						body<script.size() ? &compiled : NULL, total);
+		}));
+	for ( auto &t : pool ) t.join();
+	libssh2_exit();
+	printf("%d hosts in %.1f seconds\n", (int)hosts.size(),
+			std::chrono::duration<double>(
+				std::chrono::steady_clock::now()-start).count());
+	return 0;
+}
 int main(int argc, char **argv)
 {
+	if ( argc>2 && strcmp(argv[1], "--replay")==0 )
+		return replay_bench(argv[2]);
+	if ( argc>3 && strcmp(argv[1], "--batch")==0 ) {
+		int parallel = 8;
+		if ( argc>5 && strcmp(argv[4], "--parallel")==0 )
+			parallel = atoi(argv[5]);
+		return batch_run(argv[2], argv[3], parallel);
+	}
+
 	httpd_init();
 	libssh2_init(0);
 	Fl::scheme("gtk+");
@@ -912,6 +1396,8 @@ int main(int argc, char **argv)
 #endif
 
 	connect_dlg_build();
+	tabs_dlg_build();
+	hist_dlg_build();
 	load_dict();		//get fontface
 	font_dlg_build();	//get fontnum
 	pTerm->textfont(fontnum);
@@ -936,139 +1422,3 @@ int main(int argc, char **argv)
 	httpd_exit();
 	return 0;
 }
-/**********************************HTTPd**************************************/
-const char HEADER[]="HTTP/1.1 200 OK\nServer: FLTerm\n\
-Access-Control-Allow-Origin: *\nContent-Type: text/plain\n\
-Cache-Control: no-cache\nContent-length: %d\n\n";
-
-const char *RFC1123FMT="%a, %d %b %Y %H:%M:%S GMT";
-const char *exts[]={".txt",
-					".htm", ".html",
-					".js",
-					".jpg", ".jpeg",
-					".png",
-					".css"
-					};
-const char *mime[]={"text/plain",
-					"text/html", "text/html",
-					"text/javascript",
-					"image/jpeg", "image/jpeg",
-					"image/png",
-					"text/css"
-					};
-void httpFile(int s1, char *file)
-{
-	char reply[4096], timebuf[128];
-	time_t now = time(NULL);
-	strftime(timebuf, sizeof(timebuf), RFC1123FMT, gmtime(&now));
-
-	int len;
-	struct stat sb;
-	if ( stat( file, &sb ) ==-1 ) {
-		len=snprintf(reply, 4096, "HTTP/1.1 404 not found\nDate: %s\n", timebuf);
-		len+=snprintf(reply+len, 4096-len, "Server: FLTerm\nConnection: close");
-	    len+=snprintf(reply+len, 4096-len, "Content-Type: text/html\nContent-Length: 14");
-	    len+=snprintf(reply+len, 4096-len, "\n\nfile not found");
-		send(s1, reply, len, 0);
-		return;
-	}
-
-	FILE *fp = fopen( file, "rb" );
-	if ( fp!=NULL ) {
-		len=snprintf(reply, 4096, "HTTP/1.1 200 Ok\nDate: %s\n", timebuf);
-		len+=snprintf(reply+len, 4096-len, "Server: FLTerm\nConnection: close");
-
-		const char *filext=strrchr(file, '.');
-		int i=0;
-		if ( filext!=NULL ) {
-			for ( int j=0; j<8; j++ )
-				if ( strcmp(filext, exts[j])==0 ) i=j;
-		}
-		len+=snprintf(reply+len, 4096-len, "Content-Type: %s\n", mime[i]);
-
-		long filesize = sb.st_size;
-		len+=snprintf(reply+len, 4096-len, "Content-Length: %ld\n", filesize);
-		strftime(timebuf, sizeof(timebuf), RFC1123FMT, gmtime( &sb.st_mtime));
-		len+=snprintf(reply+len, 4096-len, "Last-Modified: %s\n\n", timebuf);
-
-		send(s1, reply, len, 0);
-		while ( (len=fread(reply, 1, 4096, fp))>0 )
-			if ( send(s1, reply, len, 0)==-1 ) break;
-		fclose(fp);
-	}
-}
-void httpd( int s0 )
-{
-	struct sockaddr_in cltaddr;
-	socklen_t addrsize=sizeof(cltaddr);
-	char buf[4096], *cmd;
-	const char *reply;
-	int cmdlen, replen, http_s1;
-
-	while ( (http_s1=accept(s0,(struct sockaddr*)&cltaddr,&addrsize ))!=-1 ) {
-		while ( (cmdlen=recv(http_s1,buf,4095,0))>0 ) {
-			buf[cmdlen] = 0;
-			if ( strncmp(buf, "GET /",5)!=0 ) break;//serve only get request
-
-			cmd = buf+5;
-			char *p = strchr(cmd, ' ');
-			if ( p!=NULL ) *p = 0;
-			for ( char *p=cmd; *p; p++ ) if ( *p=='+' ) *p=' ';
-			fl_decode_uri(cmd);
-
-			if ( *cmd!='?' ) {	//get file
-				httpFile(http_s1, cmd);
-			}
-			else {				//CGI request
-				replen = term_command(++cmd, &reply);
-				int len = snprintf(buf, 4096, HEADER, replen);
-				if ( send(http_s1, buf, len, 0)<0 ) break;
-				len = 0;
-				while ( replen>0 ) {
-					int pkt_l = replen>8192?8192:replen;
-					len = send(http_s1, reply+len, pkt_l, 0);
-					if ( len<0 ) break;
-					reply+=len;
-					replen-=len;
-				}
-				if ( len<0 ) break;
-			}	
-		}
-		closesocket(http_s1);
-	}
-}
-static int http_s0 = -1;
-void httpd_init()
-{
-#ifdef WIN32
-    WSADATA wsadata;
-    WSAStartup(MAKEWORD(2,0), &wsadata);
-#endif
-	http_s0 = socket(AF_INET, SOCK_STREAM, 0);
-	if ( http_s0==-1 ) return;
-
-	struct sockaddr_in svraddr;
-	int addrsize=sizeof(svraddr);
-	memset(&svraddr, 0, addrsize);
-	svraddr.sin_family=AF_INET;
-	svraddr.sin_addr.s_addr=inet_addr("127.0.0.1");
-	short port = 8079;
-	while ( ++port<8100 ) {
-		svraddr.sin_port=htons(port);
-		if ( bind(http_s0, (struct sockaddr*)&svraddr, addrsize)!=-1 )
-			break;
-	}
-	if ( port<8100) {
-		if ( listen(http_s0, 1)!=-1){
-			std::thread httpThread(httpd, http_s0);
-			httpThread.detach();
-			httport = port;
-			return;
-		}
-	}
-	closesocket(http_s0);
-}
-void httpd_exit()
-{
-	closesocket(http_s0);
-}